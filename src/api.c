@@ -1,7 +1,19 @@
 #include "api.h"
+#include "filter.h"
+#include "packer.h"
+#include "pool.h"
+#include "qoi.h"
+#include "raster.h"
+#include "thread.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+
+#include <sys/stat.h>
 
 #include <MiniFB.h>
 
@@ -11,23 +23,32 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "lib/stb_image_write.h"
 
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "lib/stb_image_resize2.h"
+
+#define STB_TRUETYPE_IMPLEMENTATION
+#include "lib/stb_truetype.h"
+
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 static int numArgs;
 static char **args;
 static unsigned char prevKeyStates[512] = {0};
 static unsigned char prevButtonStates[8] = {0};
 
-static void resize(struct mfb_window *window, int width, int height)
+static void resize(struct mfb_window *mfbWindow, int width, int height)
 {
-    Bitmap *bitmap = (Bitmap *)mfb_get_user_data(window);
+    Window *window = (Window *)mfb_get_user_data(mfbWindow);
+    if (window == NULL || window->frameWidth == 0 || window->frameHeight == 0)
+        return;
 
-    float scale = MIN((float)width / bitmap->width, (float)height / bitmap->height);
-    int iw = (int)(bitmap->width * scale);
-    int ih = (int)(bitmap->height * scale);
+    float scale = MIN((float)width / window->frameWidth, (float)height / window->frameHeight);
+    int iw = (int)(window->frameWidth * scale);
+    int ih = (int)(window->frameHeight * scale);
     int ox = (width - iw) / 2;
     int oy = (height - ih) / 2;
-    mfb_set_viewport(window, ox, oy, iw, ih);
+    mfb_set_viewport(mfbWindow, ox, oy, iw, ih);
 }
 
 void setArgs(int argc, char **argv)
@@ -36,353 +57,2489 @@ void setArgs(int argc, char **argv)
     args = argv;
 }
 
-void bitmapAllocate(WrenVM *vm)
+// Colors are passed either as a Pixel or as a Num holding 0xAARRGGBB, which
+// draws without allocating a foreign object.
+static unsigned int getSlotColor(WrenVM *vm, int slot)
 {
-    wrenEnsureSlots(vm, 1);
-    wrenSetSlotNewForeign(vm, 0, 0, sizeof(Bitmap));
-}
+    if (wrenGetSlotType(vm, slot) == WREN_TYPE_NUM)
+        return (unsigned int)(long long)wrenGetSlotDouble(vm, slot);
 
-void bitmapFinalize(void *data)
-{
-    Bitmap *bitmap = (Bitmap *)data;
+    Pixel *pixel = (Pixel *)wrenGetSlotForeign(vm, slot);
+    return ((unsigned int)pixel->a << 24) | (pixel->r << 16) | (pixel->g << 8) | pixel->b;
+}
 
-    if (bitmap->buffer == NULL)
-        return;
+static HeldHandle *heldHandles = NULL;
+static HeldHandle *droppedHandles = NULL;
 
-    free(bitmap->buffer);
-    bitmap->buffer = NULL;
+static void linkHandle(HeldHandle **list, HeldHandle *held)
+{
+    held->prev = NULL;
+    held->next = *list;
+    if (*list != NULL)
+        (*list)->prev = held;
+    *list = held;
 }
 
-void bitmapCreate(WrenVM *vm)
+static void unlinkHandle(HeldHandle **list, HeldHandle *held)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
-    int width = (int)wrenGetSlotDouble(vm, 1);
-    int height = (int)wrenGetSlotDouble(vm, 2);
+    if (held->prev != NULL)
+        held->prev->next = held->next;
+    else
+        *list = held->next;
 
-    bitmap->width = width;
-    bitmap->height = height;
+    if (held->next != NULL)
+        held->next->prev = held->prev;
+}
 
-    bitmap->buffer = (unsigned int *)malloc(width * height * sizeof(unsigned int));
-    if (bitmap->buffer == NULL)
+void releaseDroppedHandles(WrenVM *vm)
+{
+    HeldHandle *held = droppedHandles;
+    while (held != NULL)
     {
-        wrenSetSlotString(vm, 0, "Error allocating buffer");
-        wrenAbortFiber(vm, 0);
+        HeldHandle *next = held->next;
+        if (held->vm == vm)
+        {
+            unlinkHandle(&droppedHandles, held);
+            wrenReleaseHandle(vm, held->handle);
+            free(held);
+        }
+        held = next;
     }
 }
 
-void bitmapCreate2(WrenVM *vm)
+// The objects holding the handles are finalized inside wrenFreeVM afterwards,
+// and only free what is left of them.
+void releaseHeldHandles(WrenVM *vm)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
-    const char *path = wrenGetSlotString(vm, 1);
-
-    char fullPath[MAX_PATH_SIZE];
-    snprintf(fullPath, MAX_PATH_SIZE, "%s/%s", basePath, path);
+    releaseDroppedHandles(vm);
 
-    printf("Loading %s\n", fullPath);
-
-    bitmap->buffer = (unsigned int *)stbi_load(fullPath, &bitmap->width, &bitmap->height, NULL, 4);
-    if (bitmap->buffer == NULL)
+    for (HeldHandle *held = heldHandles; held != NULL; held = held->next)
     {
-        wrenSetSlotString(vm, 0, "Error loading image");
-        wrenAbortFiber(vm, 0);
-        return;
+        if (held->vm == vm && held->handle != NULL)
+        {
+            wrenReleaseHandle(vm, held->handle);
+            held->handle = NULL;
+        }
     }
+}
 
-    unsigned char *bytes = (unsigned char *)bitmap->buffer;
-    int n = bitmap->width * bitmap->height * 4;
+// Takes a handle to the object in slot, to be let go of with dropHandle.
+// Returns NULL if there's no memory for it.
+static HeldHandle *holdHandle(WrenVM *vm, int slot)
+{
+    releaseDroppedHandles(vm);
 
-    for (int i = 0; i < n; i += 4)
-    {
-        unsigned char b = bytes[i];
-        bytes[i] = bytes[i + 2];
-        bytes[i + 2] = b;
-    }
+    HeldHandle *held = (HeldHandle *)malloc(sizeof(HeldHandle));
+    if (held == NULL)
+        return NULL;
+
+    held->vm = vm;
+    held->handle = wrenGetSlotHandle(vm, slot);
+    linkHandle(&heldHandles, held);
+    return held;
 }
 
-void bitmapDestroy(WrenVM *vm)
+// Lets go of a handle without calling into Wren, so finalizers can use it.
+static void dropHandle(HeldHandle *held)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    unlinkHandle(&heldHandles, held);
 
-    free(bitmap->buffer);
-    bitmap->buffer = NULL;
+    if (held->handle == NULL)
+        free(held);
+    else
+        linkHandle(&droppedHandles, held);
 }
 
-void bitmapSave(WrenVM *vm)
+static size_t bitmapSize(Bitmap *bitmap)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
-    const char *path = wrenGetSlotString(vm, 1);
+    return (size_t)bitmap->width * bitmap->height * sizeof(unsigned int);
+}
 
-    char fullPath[MAX_PATH_SIZE];
-    snprintf(fullPath, MAX_PATH_SIZE, "%s/%s", basePath, path);
+// Loads an image into a pooled buffer, swapping stb's RGBA bytes into ARGB
+// words on the way.
+static unsigned int *loadImage(const char *path, int *width, int *height)
+{
+    unsigned char *pixels = stbi_load(path, width, height, NULL, 4);
+    if (pixels == NULL)
+        return NULL;
 
-    unsigned char *rgba = (unsigned char *)malloc(bitmap->width * bitmap->height * sizeof(unsigned int));
-    if (rgba == NULL)
-    {
-        wrenSetSlotString(vm, 0, "Error allocating buffer");
-        wrenAbortFiber(vm, 0);
-        return;
-    }
+    int count = *width * *height;
+    unsigned int *buffer = (unsigned int *)poolAlloc((size_t)count * sizeof(unsigned int));
+    if (buffer != NULL)
+        raster.swapRB(buffer, pixels, count);
 
-    for (int i = 0; i < bitmap->width * bitmap->height * 4; i += 4)
-    {
-        unsigned char a = bitmap->buffer[i / 4] >> 24;
-        unsigned char r = bitmap->buffer[i / 4] >> 16;
-        unsigned char g = bitmap->buffer[i / 4] >> 8;
-        unsigned char b = bitmap->buffer[i / 4];
+    stbi_image_free(pixels);
+    return buffer;
+}
 
-        rgba[i] = r;
-        rgba[i + 1] = g;
-        rgba[i + 2] = b;
-        rgba[i + 3] = a;
-    }
+// Cached images that are least recently used go first once the cache holds
+// more than budget bytes of pixels.
+typedef struct ImageCache
+{
+    CachedImage *head;
+    size_t bytes;
+    size_t budget;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+} ImageCache;
 
-    stbi_write_png(fullPath, bitmap->width, bitmap->height, 4, rgba, bitmap->width * 4);
+static ImageCache imageCache = {NULL, 0, 64 * 1024 * 1024, 0, 0, 0};
+static ImageCache textCache = {NULL, 0, 16 * 1024 * 1024, 0, 0, 0};
+static unsigned long long cacheClock = 0;
 
-    free(rgba);
-}
+#define TEXT_CACHE_SLOTS 1024
 
-void bitmapWidth(WrenVM *vm)
-{
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+static CachedImage *textSlots[TEXT_CACHE_SLOTS];
 
-    wrenSetSlotDouble(vm, 0, bitmap->width);
+static size_t cachedImageSize(CachedImage *image)
+{
+    return (size_t)image->width * image->height * sizeof(unsigned int);
 }
 
-void bitmapHeight(WrenVM *vm)
+static ImageCache *cacheOf(CachedImage *image)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
-
-    wrenSetSlotDouble(vm, 0, bitmap->height);
+    return image->text != NULL ? &textCache : &imageCache;
 }
 
-void bitmapGet(WrenVM *vm)
+static void linkCachedImage(CachedImage *image)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
-    int x = (int)wrenGetSlotDouble(vm, 1);
-    int y = (int)wrenGetSlotDouble(vm, 2);
-    Pixel *pixel = (Pixel *)wrenGetSlotForeign(vm, 3);
+    ImageCache *cache = cacheOf(image);
 
-    if (x < 0 || x >= bitmap->width || y < 0 || y >= bitmap->height)
-        return;
+    image->next = cache->head;
+    cache->head = image;
+    cache->bytes += cachedImageSize(image);
 
-    pixel->a = (bitmap->buffer[y * bitmap->width + x] >> 24) & 0xFF;
-    pixel->r = (bitmap->buffer[y * bitmap->width + x] >> 16) & 0xFF;
-    pixel->g = (bitmap->buffer[y * bitmap->width + x] >> 8) & 0xFF;
-    pixel->b = bitmap->buffer[y * bitmap->width + x] & 0xFF;
+    if (image->text != NULL)
+    {
+        CachedImage **slot = &textSlots[image->hash & (TEXT_CACHE_SLOTS - 1)];
+        image->chain = *slot;
+        *slot = image;
+    }
 }
 
-void bitmapSet(WrenVM *vm)
+static void unlinkCachedImage(CachedImage *image)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
-    int x = (int)wrenGetSlotDouble(vm, 1);
-    int y = (int)wrenGetSlotDouble(vm, 2);
-    Pixel *pixel = (Pixel *)wrenGetSlotForeign(vm, 3);
+    ImageCache *cache = cacheOf(image);
 
-    if (x < 0 || x >= bitmap->width || y < 0 || y >= bitmap->height)
-        return;
+    if (image->text != NULL)
+    {
+        for (CachedImage **link = &textSlots[image->hash & (TEXT_CACHE_SLOTS - 1)]; *link != NULL; link = &(*link)->chain)
+        {
+            if (*link == image)
+            {
+                *link = image->chain;
+                break;
+            }
+        }
+    }
 
-    bitmap->buffer[y * bitmap->width + x] = (pixel->a << 24) | (pixel->r << 16) | (pixel->g << 8) | pixel->b;
+    for (CachedImage **link = &cache->head; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == image)
+        {
+            *link = image->next;
+            cache->bytes -= cachedImageSize(image);
+            return;
+        }
+    }
 }
 
-void bitmapClear(WrenVM *vm)
+static void freeCachedImage(CachedImage *image)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
-
-    memset(bitmap->buffer, 0, bitmap->width * bitmap->height * sizeof(unsigned int));
+    poolFree(image->pixels, cachedImageSize(image));
+    free(image->text);
+    free(image);
 }
 
-void bitmapClear2(WrenVM *vm)
+// Drops the least recently used images nobody holds until the cache fits its
+// budget again.
+static void evictCachedImages(ImageCache *cache)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
-    Pixel *pixel = (Pixel *)wrenGetSlotForeign(vm, 1);
+    while (cache->bytes > cache->budget)
+    {
+        CachedImage *oldest = NULL;
+        for (CachedImage *image = cache->head; image != NULL; image = image->next)
+        {
+            if (image->refs == 0 && (oldest == NULL || image->lastUse < oldest->lastUse))
+                oldest = image;
+        }
 
-    unsigned int color = (pixel->a << 24) | (pixel->r << 16) | (pixel->g << 8) | pixel->b;
+        if (oldest == NULL)
+            return;
 
-    for (unsigned int i = 0, n = bitmap->width * bitmap->height; i < n; i++)
-        bitmap->buffer[i] = color;
+        unlinkCachedImage(oldest);
+        freeCachedImage(oldest);
+        cache->evictions++;
+    }
 }
 
-void bitmapRectangle(WrenVM *vm)
+// Returns the cached image for path, decoding it if it isn't cached or the
+// file changed since. The caller holds a reference until releaseCachedImage.
+static CachedImage *acquireCachedImage(const char *path)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
-    int x = (int)wrenGetSlotDouble(vm, 1);
-    int y = (int)wrenGetSlotDouble(vm, 2);
-    int w = (int)wrenGetSlotDouble(vm, 3);
-    int h = (int)wrenGetSlotDouble(vm, 4);
-    Pixel *pixel = (Pixel *)wrenGetSlotForeign(vm, 5);
+    struct stat info;
+    long long mtime = stat(path, &info) == 0 ? (long long)info.st_mtime : 0;
 
-    if (w <= 0 || h <= 0)
-        return;
+    for (CachedImage *image = imageCache.head; image != NULL; image = image->next)
+    {
+        if (strcmp(image->path, path) != 0)
+            continue;
 
-    int x2 = x + w - 1;
-    int y2 = y + h - 1;
+        if (image->mtime == mtime)
+        {
+            image->refs++;
+            image->lastUse = ++cacheClock;
+            imageCache.hits++;
+            return image;
+        }
 
-    if (x >= bitmap->width || x2 < 0 || y >= bitmap->height || y2 < 0)
-        return;
+        unlinkCachedImage(image);
+        if (image->refs == 0)
+            freeCachedImage(image);
+        else
+            image->stale = true;
+        break;
+    }
 
-    if (x < 0)
-        x = 0;
-    if (y < 0)
-        y = 0;
-    if (x2 >= bitmap->width)
-        x2 = bitmap->width - 1;
-    if (y2 >= bitmap->height)
-        y2 = bitmap->height - 1;
+    imageCache.misses++;
 
-    unsigned int color = (pixel->a << 24) | (pixel->r << 16) | (pixel->g << 8) | pixel->b;
+    CachedImage *image = (CachedImage *)calloc(1, sizeof(CachedImage));
+    if (image == NULL)
+        return NULL;
 
-    int clippedW = x2 - x + 1;
-    int nextRow = bitmap->width - clippedW;
-    unsigned int *p = bitmap->buffer + y * bitmap->width + x;
-    for (int i = y; i <= y2; i++)
+    image->pixels = loadImage(path, &image->width, &image->height);
+    if (image->pixels == NULL)
     {
-        for (int j = 0; j < clippedW; j++)
-            *p++ = color;
+        free(image);
+        return NULL;
+    }
+
+    snprintf(image->path, MAX_PATH_SIZE, "%s", path);
+    image->mtime = mtime;
+    image->refs = 1;
+    image->lastUse = ++cacheClock;
+    linkCachedImage(image);
 
-        p += nextRow;
+    evictCachedImages(&imageCache);
+    return image;
+}
+
+static void releaseCachedImage(CachedImage *image)
+{
+    image->refs--;
+
+    if (image->stale)
+    {
+        if (image->refs == 0)
+            freeCachedImage(image);
+        return;
     }
+
+    evictCachedImages(cacheOf(image));
 }
 
-void bitmapBlit(WrenVM *vm)
+// Points bitmap at the cached pixels of the image at path.
+static bool loadCachedBitmap(Bitmap *bitmap, const char *path)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
-    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
-    int x = (int)wrenGetSlotDouble(vm, 2);
-    int y = (int)wrenGetSlotDouble(vm, 3);
+    CachedImage *image = acquireCachedImage(path);
+    if (image == NULL)
+        return false;
+
+    bitmap->width = image->width;
+    bitmap->height = image->height;
+    bitmap->pitch = image->width;
+    bitmap->buffer = image->pixels;
+    bitmap->shared = image;
+    return true;
+}
 
-    int dst_x1 = x;
-    int dst_y1 = y;
-    int dst_x2 = x + bitmap->width - 1;
-    int dst_y2 = y + bitmap->height - 1;
-    int src_x1 = 0;
-    int src_y1 = 0;
+// Gives a bitmap that still reads from the cache a copy of its own before it
+// is drawn to. Returns false after aborting the fiber if there's no memory.
+static bool ownPixels(WrenVM *vm, Bitmap *bitmap)
+{
+    if (bitmap->shared == NULL)
+        return true;
 
-    if (dst_x1 >= dest->width)
-        return;
-    if (dst_x2 < 0)
-        return;
-    if (dst_y1 >= dest->height)
-        return;
-    if (dst_y2 < 0)
-        return;
+    unsigned int *buffer = (unsigned int *)poolAlloc(bitmapSize(bitmap));
+    if (buffer == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return false;
+    }
 
-    if (dst_x1 < 0)
+    memcpy(buffer, bitmap->buffer, bitmapSize(bitmap));
+    releaseCachedImage(bitmap->shared);
+    bitmap->shared = NULL;
+    bitmap->buffer = buffer;
+    return true;
+}
+
+// Bitmaps that finalized views or draw lists held can only be collected once
+// their handles are released, so a script allocating bitmaps without showing
+// frames still gets them back.
+void bitmapAllocate(WrenVM *vm)
+{
+    releaseDroppedHandles(vm);
+
+    wrenEnsureSlots(vm, 1);
+    wrenSetSlotNewForeign(vm, 0, 0, sizeof(Bitmap));
+}
+
+// Frees the buffer of a bitmap, or lets go of the parent of a view or the
+// cached image it reads from.
+static void releaseBitmap(Bitmap *bitmap)
+{
+    if (bitmap->parent != NULL)
     {
-        src_x1 -= dst_x1;
-        dst_x1 = 0;
+        bitmap->parent->views--;
+        dropHandle(bitmap->parentHandle);
+        bitmap->parent = NULL;
+        bitmap->parentHandle = NULL;
     }
-    if (dst_y1 < 0)
+    else if (bitmap->shared != NULL)
     {
-        src_y1 -= dst_y1;
-        dst_y1 = 0;
+        releaseCachedImage(bitmap->shared);
+        bitmap->shared = NULL;
     }
-    if (dst_x2 >= dest->width)
-        dst_x2 = dest->width - 1;
-    if (dst_y2 >= dest->height)
-        dst_y2 = dest->height - 1;
-
-    int clipped_width = dst_x2 - dst_x1 + 1;
-    int dst_next_row = dest->width - clipped_width;
-    int src_next_row = bitmap->width - clipped_width;
-    unsigned int *dst_pixel = dest->buffer + dst_y1 * dest->width + dst_x1;
-    unsigned int *src_pixel = bitmap->buffer + src_y1 * bitmap->width + src_x1;
-    for (y = dst_y1; y <= dst_y2; y++)
+    else
     {
-        for (int i = 0; i < clipped_width; i++)
-            *dst_pixel++ = *src_pixel++;
-
-        dst_pixel += dst_next_row;
-        src_pixel += src_next_row;
+        poolFree(bitmap->buffer, bitmapSize(bitmap));
     }
+
+    bitmap->buffer = NULL;
 }
 
-void bitmapBlit2(WrenVM *vm)
+void bitmapFinalize(void *data)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
-    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
-    int x = (int)wrenGetSlotDouble(vm, 2);
-    int y = (int)wrenGetSlotDouble(vm, 3);
-    Pixel *pixel = (Pixel *)wrenGetSlotForeign(vm, 4);
-
-    int dst_x1 = x;
-    int dst_y1 = y;
-    int dst_x2 = x + bitmap->width - 1;
-    int dst_y2 = y + bitmap->height - 1;
-    int src_x1 = 0;
-    int src_y1 = 0;
+    Bitmap *bitmap = (Bitmap *)data;
 
-    if (dst_x1 >= dest->width)
-        return;
-    if (dst_x2 < 0)
-        return;
-    if (dst_y1 >= dest->height)
-        return;
-    if (dst_y2 < 0)
+    if (bitmap->buffer == NULL)
         return;
 
-    if (dst_x1 < 0)
-    {
-        src_x1 -= dst_x1;
-        dst_x1 = 0;
-    }
-    if (dst_y1 < 0)
-    {
-        src_y1 -= dst_y1;
-        dst_y1 = 0;
-    }
-    if (dst_x2 >= dest->width)
-        dst_x2 = dest->width - 1;
-    if (dst_y2 >= dest->height)
-        dst_y2 = dest->height - 1;
+    releaseBitmap(bitmap);
+}
 
-    unsigned int color = (pixel->a << 24) | (pixel->r << 16) | (pixel->g << 8) | pixel->b;
+void bitmapCreate(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int width = (int)wrenGetSlotDouble(vm, 1);
+    int height = (int)wrenGetSlotDouble(vm, 2);
 
-    int clipped_width = dst_x2 - dst_x1 + 1;
-    int dst_next_row = dest->width - clipped_width;
-    int src_next_row = bitmap->width - clipped_width;
-    unsigned int *dst_pixel = dest->buffer + dst_y1 * dest->width + dst_x1;
-    unsigned int *src_pixel = bitmap->buffer + src_y1 * bitmap->width + src_x1;
-    for (y = dst_y1; y <= dst_y2; y++)
-    {
-        for (int i = 0; i < clipped_width; i++)
-        {
-            unsigned int src_color = *src_pixel;
-            unsigned int dst_color = *dst_pixel;
-            *dst_pixel = src_color != color ? src_color : dst_color;
-            src_pixel++;
-            dst_pixel++;
-        }
+    bitmap->width = width;
+    bitmap->height = height;
+    bitmap->pitch = width;
 
-        dst_pixel += dst_next_row;
-        src_pixel += src_next_row;
+    bitmap->buffer = (unsigned int *)poolAlloc(bitmapSize(bitmap));
+    if (bitmap->buffer == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
     }
 }
 
-void bitmapBlitRec(WrenVM *vm)
+void bitmapCreate2(WrenVM *vm)
 {
-    Bitmap *src = (Bitmap *)wrenGetSlotForeign(vm, 0);
-    Bitmap *dst = (Bitmap *)wrenGetSlotForeign(vm, 1);
-    int dst_x = (int)wrenGetSlotDouble(vm, 2);
-    int dst_y = (int)wrenGetSlotDouble(vm, 3);
-    int src_x = (int)wrenGetSlotDouble(vm, 4);
-    int src_y = (int)wrenGetSlotDouble(vm, 5);
-    int src_width = (int)wrenGetSlotDouble(vm, 6);
-    int src_height = (int)wrenGetSlotDouble(vm, 7);
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    const char *path = wrenGetSlotString(vm, 1);
 
-    if (src_x + src_width - 1 >= src->width)
+    char fullPath[MAX_PATH_SIZE];
+    snprintf(fullPath, MAX_PATH_SIZE, "%s/%s", basePath, path);
+
+    if (!loadCachedBitmap(bitmap, fullPath))
     {
-        wrenSetSlotString(vm, 0, "Invalid bitmap coordinates");
+        wrenSetSlotString(vm, 0, "Error loading image");
         wrenAbortFiber(vm, 0);
-        return;
     }
+}
+
+void bitmapDestroy(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
 
-    if (src_y + src_height - 1 >= src->height)
+    if (bitmap->views > 0)
     {
-        wrenSetSlotString(vm, 0, "Invalid bitmap coordinates");
+        wrenSetSlotString(vm, 0, "Bitmap has live views");
         wrenAbortFiber(vm, 0);
         return;
     }
 
+    if (bitmap->buffer == NULL)
+        return;
+
+    releaseBitmap(bitmap);
+}
+
+void bitmapPoolStats(WrenVM *vm)
+{
+    PoolStats stats = poolStats();
+
+    wrenEnsureSlots(vm, 3);
+    wrenSetSlotNewMap(vm, 0);
+
+    wrenSetSlotString(vm, 1, "hits");
+    wrenSetSlotDouble(vm, 2, (double)stats.hits);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "misses");
+    wrenSetSlotDouble(vm, 2, (double)stats.misses);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "live");
+    wrenSetSlotDouble(vm, 2, (double)stats.live);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "pooled");
+    wrenSetSlotDouble(vm, 2, (double)stats.pooled);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "resident");
+    wrenSetSlotDouble(vm, 2, (double)(stats.live + stats.pooled));
+    wrenSetMapValue(vm, 0, 1, 2);
+}
+
+void bitmapTrimPool(WrenVM *vm)
+{
+    poolTrim();
+}
+
+void bitmapCacheStats(WrenVM *vm)
+{
+    int entries = 0;
+    for (CachedImage *image = imageCache.head; image != NULL; image = image->next)
+        entries++;
+
+    wrenEnsureSlots(vm, 3);
+    wrenSetSlotNewMap(vm, 0);
+
+    wrenSetSlotString(vm, 1, "hits");
+    wrenSetSlotDouble(vm, 2, (double)imageCache.hits);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "misses");
+    wrenSetSlotDouble(vm, 2, (double)imageCache.misses);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "evictions");
+    wrenSetSlotDouble(vm, 2, (double)imageCache.evictions);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "entries");
+    wrenSetSlotDouble(vm, 2, entries);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "bytes");
+    wrenSetSlotDouble(vm, 2, (double)imageCache.bytes);
+    wrenSetMapValue(vm, 0, 1, 2);
+}
+
+void bitmapCacheBudget(WrenVM *vm)
+{
+    wrenSetSlotDouble(vm, 0, (double)imageCache.budget);
+}
+
+void bitmapCacheBudgetSet(WrenVM *vm)
+{
+    double budget = wrenGetSlotDouble(vm, 1);
+
+    imageCache.budget = budget > 0 ? (size_t)budget : 0;
+    evictCachedImages(&imageCache);
+}
+
+static Mutex *imageMutex = NULL;
+static Cond *imageDone = NULL;
+static int pendingSaves = 0;
+
+// PNGs being encoded off the main thread. stb reads its compression level
+// global while it encodes, so the level only changes when this is zero.
+static int pngWriters = 0;
+
+static bool startImageJobs(void)
+{
+    if (imageMutex == NULL)
+    {
+        imageMutex = mutexCreate();
+        imageDone = condCreate();
+    }
+
+    return imageMutex != NULL && imageDone != NULL;
+}
+
+void bitmapPngCompression(WrenVM *vm)
+{
+    wrenSetSlotDouble(vm, 0, stbi_write_png_compression_level);
+}
+
+// Higher levels make smaller files and slower saves. stb treats anything
+// below 5 as 5. Waits for saves and recorded frames being encoded to finish
+// first. Without the image mutex none can have been started.
+void bitmapPngCompressionSet(WrenVM *vm)
+{
+    int level = (int)wrenGetSlotDouble(vm, 1);
+
+    if (!startImageJobs())
+    {
+        stbi_write_png_compression_level = level;
+        return;
+    }
+
+    mutexLock(imageMutex);
+    while (pngWriters > 0)
+        condWait(imageDone, imageMutex);
+    stbi_write_png_compression_level = level;
+    mutexUnlock(imageMutex);
+}
+
+// Writes RGBA bytes as a PNG, counted in pngWriters once other threads can
+// be saving.
+static bool writePng(const char *path, const void *pixels, int width, int height, int stride)
+{
+    bool counted = imageMutex != NULL;
+    if (counted)
+    {
+        mutexLock(imageMutex);
+        pngWriters++;
+        mutexUnlock(imageMutex);
+    }
+
+    bool written = stbi_write_png(path, width, height, 4, pixels, stride) != 0;
+
+    if (counted)
+    {
+        mutexLock(imageMutex);
+        pngWriters--;
+        condBroadcast(imageDone);
+        mutexUnlock(imageMutex);
+    }
+
+    return written;
+}
+
+static void swapRows(Bitmap *bitmap)
+{
+    for (int y = 0; y < bitmap->height; y++)
+    {
+        unsigned int *row = bitmap->buffer + y * bitmap->pitch;
+        raster.swapRB(row, row, bitmap->width);
+    }
+}
+
+// Picks the file format from the extension of path. Anything unknown is
+// written as PNG.
+static ImageFormat pathToImageFormat(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    if (dot == NULL || strlen(dot) != 4)
+        return IMAGE_PNG;
+
+    char ext[5];
+    for (int i = 0; i < 5; i++)
+        ext[i] = (char)tolower((unsigned char)dot[i]);
+
+    if (strcmp(ext, ".bmp") == 0)
+        return IMAGE_BMP;
+    if (strcmp(ext, ".tga") == 0)
+        return IMAGE_TGA;
+    if (strcmp(ext, ".qoi") == 0)
+        return IMAGE_QOI;
+
+    return IMAGE_PNG;
+}
+
+// QOI is written straight from ARGB words. The stb writers take RGBA bytes,
+// and BMP and TGA also want rows without gaps.
+static bool formatWantsRgba(ImageFormat format)
+{
+    return format != IMAGE_QOI;
+}
+
+static bool formatWantsPacked(ImageFormat format)
+{
+    return format == IMAGE_BMP || format == IMAGE_TGA;
+}
+
+static bool writeImage(const char *path, ImageFormat format, unsigned int *pixels, int width, int height, int pitch)
+{
+    switch (format)
+    {
+    case IMAGE_BMP:
+        return stbi_write_bmp(path, width, height, 4, pixels) != 0;
+    case IMAGE_TGA:
+        return stbi_write_tga(path, width, height, 4, pixels) != 0;
+    case IMAGE_QOI:
+        return qoiWrite(path, pixels, width, height, pitch);
+    default:
+        return writePng(path, pixels, width, height, pitch * sizeof(unsigned int));
+    }
+}
+
+// Copies the pixels into a packed pooled buffer, converting them to RGBA
+// bytes on the way if rgba is set.
+static unsigned int *snapshotPixels(Bitmap *bitmap, bool rgba)
+{
+    unsigned int *pixels = (unsigned int *)poolAlloc(bitmapSize(bitmap));
+    if (pixels == NULL)
+        return NULL;
+
+    for (int y = 0; y < bitmap->height; y++)
+    {
+        unsigned int *dst = pixels + y * bitmap->width;
+        unsigned int *src = bitmap->buffer + y * bitmap->pitch;
+
+        if (rgba)
+            raster.swapRB(dst, src, bitmap->width);
+        else
+            raster.copy(dst, src, bitmap->width);
+    }
+
+    return pixels;
+}
+
+void bitmapSave(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    const char *path = wrenGetSlotString(vm, 1);
+
+    char fullPath[MAX_PATH_SIZE];
+    snprintf(fullPath, MAX_PATH_SIZE, "%s/%s", basePath, path);
+
+    ImageFormat format = pathToImageFormat(path);
+    bool rgba = formatWantsRgba(format);
+    bool saved;
+
+    if (formatWantsPacked(format) && bitmap->pitch != bitmap->width)
+    {
+        unsigned int *pixels = snapshotPixels(bitmap, rgba);
+        if (pixels == NULL)
+        {
+            wrenSetSlotString(vm, 0, "Error allocating buffer");
+            wrenAbortFiber(vm, 0);
+            return;
+        }
+
+        saved = writeImage(fullPath, format, pixels, bitmap->width, bitmap->height, bitmap->width);
+        poolFree(pixels, bitmapSize(bitmap));
+    }
+    else
+    {
+        // The RGBA bytes stb wants are the buffer itself with R and B
+        // swapped. The rows are swapped in place for the write and back again
+        // afterwards, so no copy of the image is made.
+        if (rgba)
+            swapRows(bitmap);
+
+        saved = writeImage(fullPath, format, bitmap->buffer, bitmap->width, bitmap->height, bitmap->pitch);
+
+        if (rgba)
+            swapRows(bitmap);
+    }
+
+    if (!saved)
+    {
+        wrenSetSlotString(vm, 0, "Error saving image");
+        wrenAbortFiber(vm, 0);
+    }
+}
+
+void bitmapWidth(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotDouble(vm, 0, bitmap->width);
+}
+
+void bitmapHeight(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotDouble(vm, 0, bitmap->height);
+}
+
+// Inclusive rectangle that drawing is restricted to. It is the whole bitmap
+// for immediate drawing and a single tile when a DrawList runs tiled.
+typedef struct Clip
+{
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+} Clip;
+
+static Clip bitmapClip(Bitmap *bitmap)
+{
+    Clip clip = {0, 0, bitmap->width - 1, bitmap->height - 1};
+    return clip;
+}
+
+// Records that the inclusive rectangle (x1, y1)-(x2, y2), already clipped to
+// the bitmap, was drawn to. Rects that touch an existing one are merged into
+// it; once the list is full the rect joins whichever one grows the least.
+// A view passes the rect on to its parent whether or not it tracks itself,
+// since its pixels are the parent's.
+static void markDirty(Bitmap *bitmap, int x1, int y1, int x2, int y2)
+{
+    if (x1 > x2 || y1 > y2)
+        return;
+
+    if (bitmap->parent != NULL)
+    {
+        if (bitmap->trackDirty && !bitmap->changed)
+            bitmap->changed = true;
+
+        markDirty(bitmap->parent, x1 + bitmap->parentX, y1 + bitmap->parentY, x2 + bitmap->parentX, y2 + bitmap->parentY);
+        return;
+    }
+
+    if (!bitmap->trackDirty)
+        return;
+
+    bitmap->changed = true;
+
+    int target = -1;
+    long long targetGrowth = 0;
+    bool touches = false;
+    for (int i = 0; i < bitmap->dirtyCount; i++)
+    {
+        DirtyRect *rect = &bitmap->dirty[i];
+
+        long long area = (long long)(rect->x2 - rect->x1 + 1) * (rect->y2 - rect->y1 + 1);
+        long long merged = (long long)(MAX(rect->x2, x2) - MIN(rect->x1, x1) + 1) * (MAX(rect->y2, y2) - MIN(rect->y1, y1) + 1);
+        if (merged == area)
+            return;
+
+        if (x1 <= rect->x2 + 1 && x2 >= rect->x1 - 1 && y1 <= rect->y2 + 1 && y2 >= rect->y1 - 1)
+        {
+            target = i;
+            touches = true;
+            break;
+        }
+
+        if (target < 0 || merged - area < targetGrowth)
+        {
+            target = i;
+            targetGrowth = merged - area;
+        }
+    }
+
+    if (!touches && bitmap->dirtyCount < MAX_DIRTY_RECTS)
+    {
+        DirtyRect rect = {x1, y1, x2, y2};
+        bitmap->dirty[bitmap->dirtyCount++] = rect;
+        return;
+    }
+
+    DirtyRect *rect = &bitmap->dirty[target];
+    rect->x1 = MIN(rect->x1, x1);
+    rect->y1 = MIN(rect->y1, y1);
+    rect->x2 = MAX(rect->x2, x2);
+    rect->y2 = MAX(rect->y2, y2);
+}
+
+static void markDirtyClipped(Bitmap *bitmap, const Clip *clip, int x1, int y1, int x2, int y2)
+{
+    markDirty(bitmap, MAX(x1, clip->x1), MAX(y1, clip->y1), MIN(x2, clip->x2), MIN(y2, clip->y2));
+}
+
+// Forgets the dirty rects after the whole bitmap was filled with color. A view
+// only covers part of its parent, so it marks itself dirty instead.
+static void resetDirty(Bitmap *bitmap, unsigned int color)
+{
+    if (bitmap->parent != NULL)
+    {
+        markDirty(bitmap, 0, 0, bitmap->width - 1, bitmap->height - 1);
+        return;
+    }
+
+    bitmap->cleared = true;
+    bitmap->clearColor = color;
+    bitmap->dirtyCount = 0;
+    bitmap->changed = true;
+}
+
+// Fills the whole bitmap with color. With dirty tracking on and the same
+// color as the previous clear, everything outside the dirty rects already has
+// that color, so only the dirty rects are filled.
+static void clearBitmap(Bitmap *bitmap, unsigned int color)
+{
+    if (bitmap->trackDirty && bitmap->cleared && bitmap->clearColor == color)
+    {
+        for (int i = 0; i < bitmap->dirtyCount; i++)
+        {
+            DirtyRect *rect = &bitmap->dirty[i];
+
+            int width = rect->x2 - rect->x1 + 1;
+            unsigned int *p = bitmap->buffer + rect->y1 * bitmap->pitch + rect->x1;
+            for (int y = rect->y1; y <= rect->y2; y++)
+            {
+                raster.fill(p, width, color);
+                p += bitmap->pitch;
+            }
+        }
+
+        if (bitmap->dirtyCount > 0)
+            bitmap->changed = true;
+        bitmap->dirtyCount = 0;
+        return;
+    }
+
+    if (bitmap->pitch == bitmap->width)
+    {
+        raster.fill(bitmap->buffer, bitmap->width * bitmap->height, color);
+    }
+    else
+    {
+        for (int y = 0; y < bitmap->height; y++)
+            raster.fill(bitmap->buffer + y * bitmap->pitch, bitmap->width, color);
+    }
+
+    resetDirty(bitmap, color);
+}
+
+void bitmapGet(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    Pixel *pixel = (Pixel *)wrenGetSlotForeign(vm, 3);
+
+    if (x < 0 || x >= bitmap->width || y < 0 || y >= bitmap->height)
+        return;
+
+    pixel->a = (bitmap->buffer[y * bitmap->pitch + x] >> 24) & 0xFF;
+    pixel->r = (bitmap->buffer[y * bitmap->pitch + x] >> 16) & 0xFF;
+    pixel->g = (bitmap->buffer[y * bitmap->pitch + x] >> 8) & 0xFF;
+    pixel->b = bitmap->buffer[y * bitmap->pitch + x] & 0xFF;
+}
+
+void bitmapGet2(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+
+    if (x < 0 || x >= bitmap->width || y < 0 || y >= bitmap->height)
+    {
+        wrenSetSlotDouble(vm, 0, 0);
+        return;
+    }
+
+    wrenSetSlotDouble(vm, 0, bitmap->buffer[y * bitmap->pitch + x]);
+}
+
+void bitmapSet(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    if (x < 0 || x >= bitmap->width || y < 0 || y >= bitmap->height)
+        return;
+
+    bitmap->buffer[y * bitmap->pitch + x] = getSlotColor(vm, 3);
+    markDirty(bitmap, x, y, x, y);
+}
+
+void bitmapClear(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    clearBitmap(bitmap, 0);
+}
+
+void bitmapClear2(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    unsigned int color = getSlotColor(vm, 1);
+
+    clearBitmap(bitmap, color);
+}
+
+void bitmapTrackDirty(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotBool(vm, 0, bitmap->trackDirty);
+}
+
+void bitmapTrackDirtySet(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+
+    bitmap->trackDirty = wrenGetSlotBool(vm, 1);
+    bitmap->cleared = false;
+    bitmap->dirtyCount = 0;
+    bitmap->changed = true;
+}
+
+void bitmapDirty(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotBool(vm, 0, !bitmap->trackDirty || bitmap->changed);
+}
+
+void bitmapInvalidate(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+
+    markDirty(bitmap, 0, 0, bitmap->width - 1, bitmap->height - 1);
+}
+
+static bool checkBounds(WrenVM *vm, int width, int height, int x, int y, int w, int h)
+{
+    if (x < 0 || y < 0 || w < 0 || h < 0 || x + w - 1 >= width || y + h - 1 >= height)
+    {
+        wrenSetSlotString(vm, 0, "Invalid bitmap coordinates");
+        wrenAbortFiber(vm, 0);
+        return false;
+    }
+
+    return true;
+}
+
+static bool checkRegion(WrenVM *vm, Bitmap *src, int src_x, int src_y, int src_width, int src_height)
+{
+    return checkBounds(vm, src->width, src->height, src_x, src_y, src_width, src_height);
+}
+
+// Makes the new bitmap in slot 0 alias a rectangle of the one in slot 1. The
+// parent stays alive as long as the view does.
+void bitmapView(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *parent = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+    int width = (int)wrenGetSlotDouble(vm, 4);
+    int height = (int)wrenGetSlotDouble(vm, 5);
+
+    if (!checkRegion(vm, parent, x, y, width, height))
+        return;
+
+    // The view aliases the parent's pixels, so they can't stay shared.
+    if (!ownPixels(vm, parent))
+        return;
+
+    HeldHandle *parentHandle = holdHandle(vm, 1);
+    if (parentHandle == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    bitmap->width = width;
+    bitmap->height = height;
+    bitmap->pitch = parent->pitch;
+    bitmap->buffer = parent->buffer + y * parent->pitch + x;
+    bitmap->parent = parent;
+    bitmap->parentHandle = parentHandle;
+    bitmap->parentX = x;
+    bitmap->parentY = y;
+    bitmap->trackDirty = true;
+
+    parent->views++;
+}
+
+static bool checkBytes(WrenVM *vm, int length, int expected)
+{
+    if (length != expected)
+    {
+        wrenSetSlotString(vm, 0, "Invalid pixel data size");
+        wrenAbortFiber(vm, 0);
+        return false;
+    }
+
+    return true;
+}
+
+// Rows and rects are moved as raw 32-bit ARGB pixels in native byte order,
+// the same layout as the bitmap buffer, packed into a Wren string.
+void bitmapGetRow(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int y = (int)wrenGetSlotDouble(vm, 1);
+
+    if (!checkRegion(vm, bitmap, 0, y, bitmap->width, 1))
+        return;
+
+    wrenSetSlotBytes(vm, 0, (const char *)(bitmap->buffer + y * bitmap->pitch), bitmap->width * sizeof(unsigned int));
+}
+
+void bitmapSetRow(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int y = (int)wrenGetSlotDouble(vm, 1);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    int length;
+    const char *bytes = wrenGetSlotBytes(vm, 2, &length);
+
+    if (!checkRegion(vm, bitmap, 0, y, bitmap->width, 1))
+        return;
+    if (!checkBytes(vm, length, bitmap->width * sizeof(unsigned int)))
+        return;
+
+    memcpy(bitmap->buffer + y * bitmap->pitch, bytes, length);
+    markDirty(bitmap, 0, y, bitmap->width - 1, y);
+}
+
+void bitmapGetRect(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    int width = (int)wrenGetSlotDouble(vm, 3);
+    int height = (int)wrenGetSlotDouble(vm, 4);
+
+    if (!checkRegion(vm, bitmap, x, y, width, height))
+        return;
+
+    int rowSize = width * sizeof(unsigned int);
+    char *bytes = (char *)malloc(rowSize * height + 1);
+    if (bytes == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    for (int i = 0; i < height; i++)
+        memcpy(bytes + i * rowSize, bitmap->buffer + (y + i) * bitmap->pitch + x, rowSize);
+
+    wrenSetSlotBytes(vm, 0, bytes, rowSize * height);
+    free(bytes);
+}
+
+void bitmapSetRect(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    int width = (int)wrenGetSlotDouble(vm, 3);
+    int height = (int)wrenGetSlotDouble(vm, 4);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    int length;
+    const char *bytes = wrenGetSlotBytes(vm, 5, &length);
+
+    if (!checkRegion(vm, bitmap, x, y, width, height))
+        return;
+    if (!checkBytes(vm, length, width * height * sizeof(unsigned int)))
+        return;
+
+    int rowSize = width * sizeof(unsigned int);
+    for (int i = 0; i < height; i++)
+        memcpy(bitmap->buffer + (y + i) * bitmap->pitch + x, bytes + i * rowSize, rowSize);
+
+    markDirty(bitmap, x, y, x + width - 1, y + height - 1);
+}
+
+typedef enum
+{
+    LAYOUT_RGBA,
+    LAYOUT_BGRA,
+    LAYOUT_GRAY
+} PixelLayout;
+
+static bool stringToPixelLayout(const char *str, PixelLayout *layout)
+{
+    if (strcmp(str, "rgba") == 0)
+        *layout = LAYOUT_RGBA;
+    else if (strcmp(str, "bgra") == 0)
+        *layout = LAYOUT_BGRA;
+    else if (strcmp(str, "gray") == 0)
+        *layout = LAYOUT_GRAY;
+    else
+        return false;
+
+    return true;
+}
+
+// Replaces every pixel with bytes in the given layout. "bgra" is the byte
+// order of the bitmap buffer itself on little-endian machines, so it is a
+// straight copy.
+void bitmapCopyFrom(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    const char *layoutName = wrenGetSlotString(vm, 2);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    int length;
+    const char *bytes = wrenGetSlotBytes(vm, 1, &length);
+
+    PixelLayout layout;
+    if (!stringToPixelLayout(layoutName, &layout))
+    {
+        wrenSetSlotString(vm, 0, "Invalid pixel format");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    int width = bitmap->width;
+    int rowSize = layout == LAYOUT_GRAY ? width : width * 4;
+    if (!checkBytes(vm, length, rowSize * bitmap->height))
+        return;
+
+    for (int y = 0; y < bitmap->height; y++)
+    {
+        unsigned int *row = bitmap->buffer + y * bitmap->pitch;
+        const char *src = bytes + y * rowSize;
+
+        if (layout == LAYOUT_RGBA)
+            raster.swapRB(row, src, width);
+        else if (layout == LAYOUT_BGRA)
+            memcpy(row, src, rowSize);
+        else
+            raster.grayToArgb(row, (const unsigned char *)src, width);
+    }
+
+    markDirty(bitmap, 0, 0, bitmap->width - 1, bitmap->height - 1);
+}
+
+static void fillRegion(Bitmap *bitmap, const Clip *clip, int x, int y, int w, int h, unsigned int color)
+{
+    if (w <= 0 || h <= 0)
+        return;
+
+    int x2 = x + w - 1;
+    int y2 = y + h - 1;
+
+    if (x > clip->x2 || x2 < clip->x1 || y > clip->y2 || y2 < clip->y1)
+        return;
+
+    if (x < clip->x1)
+        x = clip->x1;
+    if (y < clip->y1)
+        y = clip->y1;
+    if (x2 > clip->x2)
+        x2 = clip->x2;
+    if (y2 > clip->y2)
+        y2 = clip->y2;
+
+    markDirty(bitmap, x, y, x2, y2);
+
+    int clippedW = x2 - x + 1;
+    unsigned int *p = bitmap->buffer + y * bitmap->pitch + x;
+    for (int i = y; i <= y2; i++)
+    {
+        raster.fill(p, clippedW, color);
+        p += bitmap->pitch;
+    }
+}
+
+// Returns the bitmap that owns the pixels a view aliases, following views of
+// views, and adds the view's offset in it to (x, y).
+static Bitmap *rootBitmap(Bitmap *bitmap, int *x, int *y)
+{
+    while (bitmap->parent != NULL)
+    {
+        *x += bitmap->parentX;
+        *y += bitmap->parentY;
+        bitmap = bitmap->parent;
+    }
+
+    return bitmap;
+}
+
+// True if two bitmaps alias any of the same pixels. Bitmaps with different
+// roots never do, since shared cached pixels are copied before a write.
+static bool bitmapsOverlap(Bitmap *a, Bitmap *b)
+{
+    int ax = 0, ay = 0, bx = 0, by = 0;
+    if (rootBitmap(a, &ax, &ay) != rootBitmap(b, &bx, &by))
+        return false;
+
+    return ax < bx + b->width && bx < ax + a->width && ay < by + b->height && by < ay + a->height;
+}
+
+#define SPAN_CHUNK 256
+
+// copyKeyed and blend for a span whose source may overlap it. The source goes
+// through a scratch buffer a chunk at a time, starting from the end the span
+// moves towards, so no chunk reads pixels an earlier one wrote.
+static void copyKeyedOverlapping(unsigned int *dst, const unsigned int *src, int count, unsigned int key)
+{
+    unsigned int scratch[SPAN_CHUNK];
+    bool backward = dst > src;
+
+    for (int done = 0; done < count; done += SPAN_CHUNK)
+    {
+        int n = MIN(SPAN_CHUNK, count - done);
+        int start = backward ? count - done - n : done;
+
+        memcpy(scratch, src + start, n * sizeof(unsigned int));
+        raster.copyKeyed(dst + start, scratch, n, key);
+    }
+}
+
+static void blendOverlapping(unsigned int *dst, const unsigned int *src, int count, BlendMode mode, unsigned int opacity)
+{
+    unsigned int scratch[SPAN_CHUNK];
+    bool backward = dst > src;
+
+    for (int done = 0; done < count; done += SPAN_CHUNK)
+    {
+        int n = MIN(SPAN_CHUNK, count - done);
+        int start = backward ? count - done - n : done;
+
+        memcpy(scratch, src + start, n * sizeof(unsigned int));
+        raster.blend(dst + start, scratch, n, mode, opacity);
+    }
+}
+
+static void blitRegion(Bitmap *dst, const Clip *clip, Bitmap *src, int dst_x, int dst_y, int src_x, int src_y, int src_width, int src_height, bool keyed, unsigned int color_key)
+{
+    int dst_x1 = dst_x;
+    int dst_y1 = dst_y;
+    int dst_x2 = dst_x + src_width - 1;
+    int dst_y2 = dst_y + src_height - 1;
+    int src_x1 = src_x;
+    int src_y1 = src_y;
+
+    if (dst_x1 > clip->x2)
+        return;
+    if (dst_x2 < clip->x1)
+        return;
+    if (dst_y1 > clip->y2)
+        return;
+    if (dst_y2 < clip->y1)
+        return;
+
+    if (dst_x1 < clip->x1)
+    {
+        src_x1 += clip->x1 - dst_x1;
+        dst_x1 = clip->x1;
+    }
+    if (dst_y1 < clip->y1)
+    {
+        src_y1 += clip->y1 - dst_y1;
+        dst_y1 = clip->y1;
+    }
+    if (dst_x2 > clip->x2)
+        dst_x2 = clip->x2;
+    if (dst_y2 > clip->y2)
+        dst_y2 = clip->y2;
+
+    markDirty(dst, dst_x1, dst_y1, dst_x2, dst_y2);
+
+    int clipped_width = dst_x2 - dst_x1 + 1;
+    unsigned int *dst_pixel = dst->buffer + dst_y1 * dst->pitch + dst_x1;
+    unsigned int *src_pixel = src->buffer + src_y1 * src->pitch + src_x1;
+
+    // Pixels shared with the source are copied in the order that reads each
+    // before it's overwritten: rows from the end they move towards, and spans
+    // through memmove or a scratch buffer.
+    if (bitmapsOverlap(dst, src))
+    {
+        int rows = dst_y2 - dst_y1 + 1;
+        int pitch = dst->pitch;
+        if (dst_pixel > src_pixel)
+        {
+            dst_pixel += (rows - 1) * pitch;
+            src_pixel += (rows - 1) * pitch;
+            pitch = -pitch;
+        }
+
+        for (int i = 0; i < rows; i++)
+        {
+            if (keyed)
+                copyKeyedOverlapping(dst_pixel, src_pixel, clipped_width, color_key);
+            else
+                memmove(dst_pixel, src_pixel, clipped_width * sizeof(unsigned int));
+
+            dst_pixel += pitch;
+            src_pixel += pitch;
+        }
+        return;
+    }
+
+    for (dst_y = dst_y1; dst_y <= dst_y2; dst_y++)
+    {
+        if (keyed)
+            raster.copyKeyed(dst_pixel, src_pixel, clipped_width, color_key);
+        else
+            raster.copy(dst_pixel, src_pixel, clipped_width);
+
+        dst_pixel += dst->pitch;
+        src_pixel += src->pitch;
+    }
+}
+
+void bitmapRectangle(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    int w = (int)wrenGetSlotDouble(vm, 3);
+    int h = (int)wrenGetSlotDouble(vm, 4);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    unsigned int color = getSlotColor(vm, 5);
+
+    Clip clip = bitmapClip(bitmap);
+    fillRegion(bitmap, &clip, x, y, w, h, color);
+}
+
+static void plotPixel(Bitmap *bitmap, const Clip *clip, int x, int y, unsigned int color)
+{
+    if (x < clip->x1 || x > clip->x2 || y < clip->y1 || y > clip->y2)
+        return;
+
+    bitmap->buffer[y * bitmap->pitch + x] = color;
+}
+
+static long long floorDiv(long long a, long long b)
+{
+    long long q = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0)))
+        q--;
+    return q;
+}
+
+static long long ceilDiv(long long a, long long b)
+{
+    return -floorDiv(-a, b);
+}
+
+// Bresenham line. Only the part of the major axis inside the clip rectangle is
+// walked; the error term for the first visible step is computed directly so
+// clipped lines hit exactly the same pixels as unclipped ones.
+static void drawLine(Bitmap *bitmap, const Clip *clip, int x1, int y1, int x2, int y2, unsigned int color)
+{
+    markDirtyClipped(bitmap, clip, MIN(x1, x2), MIN(y1, y2), MAX(x1, x2), MAX(y1, y2));
+
+    if (y1 == y2)
+    {
+        int x = x1 < x2 ? x1 : x2;
+        fillRegion(bitmap, clip, x, y1, abs(x2 - x1) + 1, 1, color);
+        return;
+    }
+    if (x1 == x2)
+    {
+        int y = y1 < y2 ? y1 : y2;
+        fillRegion(bitmap, clip, x1, y, 1, abs(y2 - y1) + 1, color);
+        return;
+    }
+
+    bool steep = abs(y2 - y1) > abs(x2 - x1);
+    int major1 = steep ? y1 : x1;
+    int major2 = steep ? y2 : x2;
+    int minor1 = steep ? x1 : y1;
+    int minor2 = steep ? x2 : y2;
+    int majorMin = steep ? clip->y1 : clip->x1;
+    int majorMax = steep ? clip->y2 : clip->x2;
+
+    long long dMajor = abs(major2 - major1);
+    long long dMinor = abs(minor2 - minor1);
+    int sMajor = major2 > major1 ? 1 : -1;
+    int sMinor = minor2 > minor1 ? 1 : -1;
+
+    // Step k of the line covers major1 + sMajor * k; keep only visible steps.
+    long long kStart = 0;
+    long long kEnd = dMajor;
+    if (sMajor > 0)
+    {
+        if (majorMin > major1)
+            kStart = majorMin - major1;
+        if (majorMax < major2)
+            kEnd = majorMax - major1;
+    }
+    else
+    {
+        if (majorMax < major1)
+            kStart = major1 - majorMax;
+        if (majorMin > major2)
+            kEnd = major1 - majorMin;
+    }
+    if (kStart > kEnd)
+        return;
+
+    long long numerator = 2 * kStart * dMinor + dMajor;
+    long long minor = minor1 + sMinor * (numerator / (2 * dMajor));
+    long long err = numerator % (2 * dMajor);
+
+    int major = major1 + sMajor * (int)kStart;
+    for (long long k = kStart; k <= kEnd; k++)
+    {
+        if (steep)
+            plotPixel(bitmap, clip, (int)minor, major, color);
+        else
+            plotPixel(bitmap, clip, major, (int)minor, color);
+
+        major += sMajor;
+        err += 2 * dMinor;
+        if (err >= 2 * dMajor)
+        {
+            err -= 2 * dMajor;
+            minor += sMinor;
+        }
+    }
+}
+
+static void drawCircle(Bitmap *bitmap, const Clip *clip, int cx, int cy, int radius, unsigned int color)
+{
+    if (radius < 0)
+        return;
+
+    markDirtyClipped(bitmap, clip, cx - radius, cy - radius, cx + radius, cy + radius);
+
+    int x = radius;
+    int y = 0;
+    int err = 1 - radius;
+    while (x >= y)
+    {
+        plotPixel(bitmap, clip, cx + x, cy + y, color);
+        plotPixel(bitmap, clip, cx - x, cy + y, color);
+        plotPixel(bitmap, clip, cx + x, cy - y, color);
+        plotPixel(bitmap, clip, cx - x, cy - y, color);
+        plotPixel(bitmap, clip, cx + y, cy + x, color);
+        plotPixel(bitmap, clip, cx - y, cy + x, color);
+        plotPixel(bitmap, clip, cx + y, cy - x, color);
+        plotPixel(bitmap, clip, cx - y, cy - x, color);
+
+        y++;
+        if (err < 0)
+            err += 2 * y + 1;
+        else
+        {
+            x--;
+            err += 2 * (y - x) + 1;
+        }
+    }
+}
+
+static void fillCircle(Bitmap *bitmap, const Clip *clip, int cx, int cy, int radius, unsigned int color)
+{
+    if (radius < 0)
+        return;
+
+    markDirtyClipped(bitmap, clip, cx - radius, cy - radius, cx + radius, cy + radius);
+
+    int x = radius;
+    int y = 0;
+    int err = 1 - radius;
+    while (x >= y)
+    {
+        fillRegion(bitmap, clip, cx - x, cy + y, 2 * x + 1, 1, color);
+        fillRegion(bitmap, clip, cx - x, cy - y, 2 * x + 1, 1, color);
+        fillRegion(bitmap, clip, cx - y, cy + x, 2 * y + 1, 1, color);
+        fillRegion(bitmap, clip, cx - y, cy - x, 2 * y + 1, 1, color);
+
+        y++;
+        if (err < 0)
+            err += 2 * y + 1;
+        else
+        {
+            x--;
+            err += 2 * (y - x) + 1;
+        }
+    }
+}
+
+// Triangle rasterizer using edge functions sampled at pixel centers, with the
+// top-left fill rule so triangles sharing an edge never overlap or leave gaps.
+// Coordinates are doubled so pixel centers are integers and each row reduces
+// to one span, filled with the span kernel.
+static void fillTriangle(Bitmap *bitmap, const Clip *clip, int x1, int y1, int x2, int y2, int x3, int y3, unsigned int color)
+{
+    long long area = (long long)(x2 - x1) * (y3 - y1) - (long long)(y2 - y1) * (x3 - x1);
+    if (area == 0)
+        return;
+
+    if (area < 0)
+    {
+        int tx = x2;
+        int ty = y2;
+        x2 = x3;
+        y2 = y3;
+        x3 = tx;
+        y3 = ty;
+    }
+
+    int vx[3] = {x1, x2, x3};
+    int vy[3] = {y1, y2, y3};
+
+    int minY = y1 < y2 ? (y1 < y3 ? y1 : y3) : (y2 < y3 ? y2 : y3);
+    int maxY = y1 > y2 ? (y1 > y3 ? y1 : y3) : (y2 > y3 ? y2 : y3);
+    if (minY < clip->y1)
+        minY = clip->y1;
+    if (maxY > clip->y2 + 1)
+        maxY = clip->y2 + 1;
+
+    int minX = MIN(x1, MIN(x2, x3));
+    int maxX = MAX(x1, MAX(x2, x3));
+    markDirtyClipped(bitmap, clip, minX, minY, maxX, maxY - 1);
+
+    for (int y = minY; y < maxY; y++)
+    {
+        long long left = clip->x1;
+        long long right = clip->x2;
+        long long py = 2 * (long long)y + 1;
+
+        for (int e = 0; e < 3 && left <= right; e++)
+        {
+            long long ax = 2 * (long long)vx[e];
+            long long ay = 2 * (long long)vy[e];
+            long long ex = 2 * (long long)vx[(e + 1) % 3] - ax;
+            long long ey = 2 * (long long)vy[(e + 1) % 3] - ay;
+
+            bool topLeft = ey < 0 || (ey == 0 && ex > 0);
+            long long bias = topLeft ? 0 : 1;
+            long long k = ex * (py - ay) + ey * ax;
+
+            // Edge function at pixel x is k - ey * (2x + 1) and must be >= bias.
+            if (ey == 0)
+            {
+                if (k < bias)
+                    right = left - 1;
+            }
+            else if (ey < 0)
+            {
+                long long bound = ceilDiv(bias - k + ey, -2 * ey);
+                if (bound > left)
+                    left = bound;
+            }
+            else
+            {
+                long long bound = floorDiv(k - bias - ey, 2 * ey);
+                if (bound < right)
+                    right = bound;
+            }
+        }
+
+        if (left <= right)
+            raster.fill(bitmap->buffer + y * bitmap->pitch + left, (int)(right - left + 1), color);
+    }
+}
+
+// Even-odd scanline fill. Each row is sampled at pixel centers and edges are
+// half-open in y, so shared vertices are counted once.
+static bool fillPolygon(Bitmap *bitmap, const Clip *clip, const double *points, int count, unsigned int color)
+{
+    if (count < 3)
+        return true;
+
+    double minX = points[0];
+    double maxX = points[0];
+    double minY = points[1];
+    double maxY = points[1];
+    for (int i = 1; i < count; i++)
+    {
+        if (points[i * 2] < minX)
+            minX = points[i * 2];
+        if (points[i * 2] > maxX)
+            maxX = points[i * 2];
+        if (points[i * 2 + 1] < minY)
+            minY = points[i * 2 + 1];
+        if (points[i * 2 + 1] > maxY)
+            maxY = points[i * 2 + 1];
+    }
+
+    int y1 = (int)ceil(minY - 0.5);
+    int y2 = (int)ceil(maxY - 0.5) - 1;
+    if (y1 < clip->y1)
+        y1 = clip->y1;
+    if (y2 > clip->y2)
+        y2 = clip->y2;
+
+    if (minX < clip->x1)
+        minX = clip->x1;
+    if (maxX > clip->x2)
+        maxX = clip->x2;
+    if (minX <= maxX)
+        markDirty(bitmap, (int)floor(minX), y1, (int)ceil(maxX), y2);
+
+    double *crossings = (double *)malloc(count * sizeof(double));
+    if (crossings == NULL)
+        return false;
+
+    for (int y = y1; y <= y2; y++)
+    {
+        double cy = y + 0.5;
+        int n = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+            double ax = points[i * 2];
+            double ay = points[i * 2 + 1];
+            double bx = points[((i + 1) % count) * 2];
+            double by = points[((i + 1) % count) * 2 + 1];
+
+            if ((ay <= cy && by > cy) || (by <= cy && ay > cy))
+            {
+                double x = ax + (cy - ay) * (bx - ax) / (by - ay);
+
+                int j = n++;
+                while (j > 0 && crossings[j - 1] > x)
+                {
+                    crossings[j] = crossings[j - 1];
+                    j--;
+                }
+                crossings[j] = x;
+            }
+        }
+
+        for (int i = 0; i + 1 < n; i += 2)
+        {
+            int x1 = (int)ceil(crossings[i] - 0.5);
+            int x2 = (int)ceil(crossings[i + 1] - 0.5) - 1;
+
+            if (x1 < clip->x1)
+                x1 = clip->x1;
+            if (x2 > clip->x2)
+                x2 = clip->x2;
+            if (x1 <= x2)
+                raster.fill(bitmap->buffer + y * bitmap->pitch + x1, x2 - x1 + 1, color);
+        }
+    }
+
+    free(crossings);
+    return true;
+}
+
+void bitmapLine(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x1 = (int)wrenGetSlotDouble(vm, 1);
+    int y1 = (int)wrenGetSlotDouble(vm, 2);
+    int x2 = (int)wrenGetSlotDouble(vm, 3);
+    int y2 = (int)wrenGetSlotDouble(vm, 4);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    unsigned int color = getSlotColor(vm, 5);
+
+    Clip clip = bitmapClip(bitmap);
+    drawLine(bitmap, &clip, x1, y1, x2, y2, color);
+}
+
+void bitmapCircle(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    int radius = (int)wrenGetSlotDouble(vm, 3);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    unsigned int color = getSlotColor(vm, 4);
+
+    Clip clip = bitmapClip(bitmap);
+    drawCircle(bitmap, &clip, x, y, radius, color);
+}
+
+void bitmapFillCircle(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    int radius = (int)wrenGetSlotDouble(vm, 3);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    unsigned int color = getSlotColor(vm, 4);
+
+    Clip clip = bitmapClip(bitmap);
+    fillCircle(bitmap, &clip, x, y, radius, color);
+}
+
+void bitmapFillTriangle(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x1 = (int)wrenGetSlotDouble(vm, 1);
+    int y1 = (int)wrenGetSlotDouble(vm, 2);
+    int x2 = (int)wrenGetSlotDouble(vm, 3);
+    int y2 = (int)wrenGetSlotDouble(vm, 4);
+    int x3 = (int)wrenGetSlotDouble(vm, 5);
+    int y3 = (int)wrenGetSlotDouble(vm, 6);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    unsigned int color = getSlotColor(vm, 7);
+
+    Clip clip = bitmapClip(bitmap);
+    fillTriangle(bitmap, &clip, x1, y1, x2, y2, x3, y3, color);
+}
+
+void bitmapFillPolygon(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    unsigned int color = getSlotColor(vm, 2);
+
+    int length = wrenGetListCount(vm, 1);
+    if (length % 2 != 0)
+    {
+        wrenSetSlotString(vm, 0, "Polygon points must be x, y pairs");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    double *points = (double *)malloc((length > 0 ? length : 1) * sizeof(double));
+    if (points == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    wrenEnsureSlots(vm, 4);
+    for (int i = 0; i < length; i++)
+    {
+        wrenGetListElement(vm, 1, i, 3);
+        points[i] = wrenGetSlotDouble(vm, 3);
+    }
+
+    Clip clip = bitmapClip(bitmap);
+    bool ok = fillPolygon(bitmap, &clip, points, length / 2, color);
+
+    free(points);
+
+    if (!ok)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+    }
+}
+
+void bitmapBlit(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    Clip clip = bitmapClip(dest);
+    blitRegion(dest, &clip, bitmap, x, y, 0, 0, bitmap->width, bitmap->height, false, 0);
+}
+
+void bitmapBlit2(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    unsigned int color = getSlotColor(vm, 4);
+
+    Clip clip = bitmapClip(dest);
+    blitRegion(dest, &clip, bitmap, x, y, 0, 0, bitmap->width, bitmap->height, true, color);
+}
+
+void bitmapBlitRec(WrenVM *vm)
+{
+    Bitmap *src = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dst = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int dst_x = (int)wrenGetSlotDouble(vm, 2);
+    int dst_y = (int)wrenGetSlotDouble(vm, 3);
+    int src_x = (int)wrenGetSlotDouble(vm, 4);
+    int src_y = (int)wrenGetSlotDouble(vm, 5);
+    int src_width = (int)wrenGetSlotDouble(vm, 6);
+    int src_height = (int)wrenGetSlotDouble(vm, 7);
+
+    if (!ownPixels(vm, dst))
+        return;
+
+    if (!checkRegion(vm, src, src_x, src_y, src_width, src_height))
+        return;
+
+    Clip clip = bitmapClip(dst);
+    blitRegion(dst, &clip, src, dst_x, dst_y, src_x, src_y, src_width, src_height, false, 0);
+}
+
+void bitmapBlitRec2(WrenVM *vm)
+{
+    Bitmap *src = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dst = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int dst_x = (int)wrenGetSlotDouble(vm, 2);
+    int dst_y = (int)wrenGetSlotDouble(vm, 3);
+    int src_x = (int)wrenGetSlotDouble(vm, 4);
+    int src_y = (int)wrenGetSlotDouble(vm, 5);
+    int src_width = (int)wrenGetSlotDouble(vm, 6);
+    int src_height = (int)wrenGetSlotDouble(vm, 7);
+
+    if (!ownPixels(vm, dst))
+        return;
+
+    if (!checkRegion(vm, src, src_x, src_y, src_width, src_height))
+        return;
+
+    unsigned int color = getSlotColor(vm, 8);
+
+    Clip clip = bitmapClip(dst);
+    blitRegion(dst, &clip, src, dst_x, dst_y, src_x, src_y, src_width, src_height, true, color);
+}
+
+typedef enum
+{
+    FILTER_NEAREST,
+    FILTER_BILINEAR
+} Filter;
+
+static bool stringToFilter(const char *str, Filter *filter)
+{
+    if (strcmp(str, "nearest") == 0)
+        *filter = FILTER_NEAREST;
+    else if (strcmp(str, "bilinear") == 0)
+        *filter = FILTER_BILINEAR;
+    else
+        return false;
+
+    return true;
+}
+
+// Interpolates two colors by f / 256, two channels per multiply.
+static unsigned int lerpColor(unsigned int a, unsigned int b, unsigned int f)
+{
+    unsigned int nf = 256 - f;
+    unsigned int rb = ((a & 0x00FF00FF) * nf + (b & 0x00FF00FF) * f) >> 8;
+    unsigned int ag = ((a >> 8) & 0x00FF00FF) * nf + ((b >> 8) & 0x00FF00FF) * f;
+
+    return (rb & 0x00FF00FF) | (ag & 0xFF00FF00);
+}
+
+// Samples src at the 16.16 position (u, v), which must lie inside the bitmap.
+// Key-colored neighbours are replaced by the nearest texel so keyed sprites
+// don't pick up a fringe of the key color.
+static bool sampleBilinear(Bitmap *src, int u, int v, bool keyed, unsigned int key, unsigned int *color)
+{
+    unsigned int center = src->buffer[(v >> 16) * src->pitch + (u >> 16)];
+    if (keyed && center == key)
+        return false;
+
+    u -= 0x8000;
+    v -= 0x8000;
+
+    int x0 = u >> 16;
+    int y0 = v >> 16;
+    int x1 = x0 + 1;
+    int y1 = y0 + 1;
+    unsigned int fx = (u >> 8) & 0xFF;
+    unsigned int fy = (v >> 8) & 0xFF;
+
+    if (x0 < 0)
+        x0 = 0;
+    if (y0 < 0)
+        y0 = 0;
+    if (x1 >= src->width)
+        x1 = src->width - 1;
+    if (y1 >= src->height)
+        y1 = src->height - 1;
+
+    unsigned int *row0 = src->buffer + y0 * src->pitch;
+    unsigned int *row1 = src->buffer + y1 * src->pitch;
+    unsigned int c00 = row0[x0];
+    unsigned int c10 = row0[x1];
+    unsigned int c01 = row1[x0];
+    unsigned int c11 = row1[x1];
+
+    if (keyed)
+    {
+        if (c00 == key)
+            c00 = center;
+        if (c10 == key)
+            c10 = center;
+        if (c01 == key)
+            c01 = center;
+        if (c11 == key)
+            c11 = center;
+    }
+
+    *color = lerpColor(lerpColor(c00, c10, fx), lerpColor(c01, c11, fx), fy);
+    return true;
+}
+
+// Fills the destination rectangle (x1, y1)-(x2, y2) by mapping each pixel
+// center back into src. (u, v) is the 16.16 source position for the center of
+// pixel (x1, y1) and the four deltas step it one pixel right and one pixel
+// down. Pixels that map outside src are left untouched.
+static void blitAffineRegion(Bitmap *dst, Bitmap *src, int x1, int y1, int x2, int y2, int u, int v, int dudx, int dvdx, int dudy, int dvdy, Filter filter, bool keyed, unsigned int key)
+{
+    if (x1 >= dst->width)
+        return;
+    if (x2 < 0)
+        return;
+    if (y1 >= dst->height)
+        return;
+    if (y2 < 0)
+        return;
+
+    long long row_u = u;
+    long long row_v = v;
+
+    if (x1 < 0)
+    {
+        row_u -= (long long)x1 * dudx;
+        row_v -= (long long)x1 * dvdx;
+        x1 = 0;
+    }
+    if (y1 < 0)
+    {
+        row_u -= (long long)y1 * dudy;
+        row_v -= (long long)y1 * dvdy;
+        y1 = 0;
+    }
+    if (x2 >= dst->width)
+        x2 = dst->width - 1;
+    if (y2 >= dst->height)
+        y2 = dst->height - 1;
+
+    markDirty(dst, x1, y1, x2, y2);
+
+    long long max_u = (long long)src->width << 16;
+    long long max_v = (long long)src->height << 16;
+
+    for (int y = y1; y <= y2; y++)
+    {
+        long long pu = row_u;
+        long long pv = row_v;
+        unsigned int *dst_pixel = dst->buffer + y * dst->pitch + x1;
+        for (int x = x1; x <= x2; x++)
+        {
+            if (pu >= 0 && pv >= 0 && pu < max_u && pv < max_v)
+            {
+                unsigned int color;
+                if (filter == FILTER_NEAREST)
+                {
+                    color = src->buffer[(int)(pv >> 16) * src->pitch + (int)(pu >> 16)];
+                    if (!keyed || color != key)
+                        *dst_pixel = color;
+                }
+                else if (sampleBilinear(src, (int)pu, (int)pv, keyed, key, &color))
+                    *dst_pixel = color;
+            }
+
+            dst_pixel++;
+            pu += dudx;
+            pv += dvdx;
+        }
+
+        row_u += dudy;
+        row_v += dvdy;
+    }
+}
+
+// True if value, already rounded, fits an int. NaN doesn't.
+static bool fitsInt(double value)
+{
+    return value >= INT_MIN && value <= INT_MAX;
+}
+
+// Draws nothing when the destination rect or the 16.16 steps don't fit an
+// int: a source wider or taller than 32767 pixels, or one squeezed into a
+// rect so small the step overflows.
+static void blitScaledRegion(Bitmap *dst, Bitmap *src, int x, int y, int width, int height, Filter filter, bool keyed, unsigned int key)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    long long step_u = ((long long)src->width << 16) / width;
+    long long step_v = ((long long)src->height << 16) / height;
+    long long x2 = (long long)x + width - 1;
+    long long y2 = (long long)y + height - 1;
+    if (!fitsInt(step_u) || !fitsInt(step_v) || !fitsInt(x2) || !fitsInt(y2))
+        return;
+
+    blitAffineRegion(dst, src, x, y, (int)x2, (int)y2, (int)(step_u / 2), (int)(step_v / 2), (int)step_u, 0, 0, (int)step_v, filter, keyed, key);
+}
+
+// Draws nothing when the source is too large for 16.16 coordinates or the
+// destination rect doesn't fit an int.
+static void blitFlippedRegion(Bitmap *dst, Bitmap *src, int x, int y, bool flipX, bool flipY, bool keyed, unsigned int key)
+{
+    long long u = flipX ? ((long long)src->width << 16) - 0x8000 : 0x8000;
+    long long v = flipY ? ((long long)src->height << 16) - 0x8000 : 0x8000;
+    long long x2 = (long long)x + src->width - 1;
+    long long y2 = (long long)y + src->height - 1;
+    if (!fitsInt(u) || !fitsInt(v) || !fitsInt(x2) || !fitsInt(y2))
+        return;
+
+    int dudx = flipX ? -0x10000 : 0x10000;
+    int dvdy = flipY ? -0x10000 : 0x10000;
+
+    blitAffineRegion(dst, src, x, y, (int)x2, (int)y2, (int)u, (int)v, dudx, 0, 0, dvdy, FILTER_NEAREST, keyed, key);
+}
+
+// Draws src rotated by angle (radians) and scaled around its center, with the
+// center landing on (x, y). Draws nothing when the transform can't be
+// expressed in the 16.16 steps of blitAffineRegion: a non-finite angle or
+// scale, a zero scale, a destination rect or source position outside the int
+// range, or a scale so small its steps overflow.
+static void blitTransformedRegion(Bitmap *dst, Bitmap *src, double x, double y, double angle, double scaleX, double scaleY, Filter filter, bool keyed, unsigned int key)
+{
+    if (!isfinite(angle) || !isfinite(scaleX) || !isfinite(scaleY))
+        return;
+    if (scaleX == 0 || scaleY == 0)
+        return;
+
+    double c = cos(angle);
+    double s = sin(angle);
+
+    double halfW = src->width * fabs(scaleX) / 2;
+    double halfH = src->height * fabs(scaleY) / 2;
+    double extentX = fabs(c) * halfW + fabs(s) * halfH;
+    double extentY = fabs(s) * halfW + fabs(c) * halfH;
+
+    double left = floor(x - extentX);
+    double top = floor(y - extentY);
+    double right = ceil(x + extentX);
+    double bottom = ceil(y + extentY);
+    if (!fitsInt(left) || !fitsInt(top) || !fitsInt(right) || !fitsInt(bottom))
+        return;
+
+    int x1 = (int)left;
+    int y1 = (int)top;
+    int x2 = (int)right;
+    int y2 = (int)bottom;
+
+    double dudx = c / scaleX;
+    double dvdx = -s / scaleY;
+    double dudy = s / scaleX;
+    double dvdy = c / scaleY;
+
+    double dx = x1 + 0.5 - x;
+    double dy = y1 + 0.5 - y;
+    double u = floor((src->width / 2.0 + dudx * dx + dudy * dy) * 65536);
+    double v = floor((src->height / 2.0 + dvdx * dx + dvdy * dy) * 65536);
+
+    double steps[4] = {trunc(dudx * 65536), trunc(dvdx * 65536), trunc(dudy * 65536), trunc(dvdy * 65536)};
+    if (!fitsInt(u) || !fitsInt(v))
+        return;
+    for (int i = 0; i < 4; i++)
+    {
+        if (!fitsInt(steps[i]))
+            return;
+    }
+
+    blitAffineRegion(dst, src, x1, y1, x2, y2,
+                     (int)u, (int)v,
+                     (int)steps[0], (int)steps[1],
+                     (int)steps[2], (int)steps[3],
+                     filter, keyed, key);
+}
+
+static bool getSlotFilter(WrenVM *vm, int slot, Filter *filter)
+{
+    if (stringToFilter(wrenGetSlotString(vm, slot), filter))
+        return true;
+
+    wrenSetSlotString(vm, 0, "Invalid filter");
+    wrenAbortFiber(vm, 0);
+    return false;
+}
+
+void bitmapBlitScaled(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+    int width = (int)wrenGetSlotDouble(vm, 4);
+    int height = (int)wrenGetSlotDouble(vm, 5);
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    blitScaledRegion(dest, bitmap, x, y, width, height, FILTER_NEAREST, false, 0);
+}
+
+void bitmapBlitScaled2(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+    int width = (int)wrenGetSlotDouble(vm, 4);
+    int height = (int)wrenGetSlotDouble(vm, 5);
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    Filter filter;
+    if (!getSlotFilter(vm, 6, &filter))
+        return;
+
+    blitScaledRegion(dest, bitmap, x, y, width, height, filter, false, 0);
+}
+
+void bitmapBlitScaled3(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+    int width = (int)wrenGetSlotDouble(vm, 4);
+    int height = (int)wrenGetSlotDouble(vm, 5);
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    Filter filter;
+    if (!getSlotFilter(vm, 6, &filter))
+        return;
+
+    unsigned int color = getSlotColor(vm, 7);
+
+    blitScaledRegion(dest, bitmap, x, y, width, height, filter, true, color);
+}
+
+void bitmapBlitFlipped(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+    bool flipX = wrenGetSlotBool(vm, 4);
+    bool flipY = wrenGetSlotBool(vm, 5);
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    blitFlippedRegion(dest, bitmap, x, y, flipX, flipY, false, 0);
+}
+
+void bitmapBlitFlipped2(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+    bool flipX = wrenGetSlotBool(vm, 4);
+    bool flipY = wrenGetSlotBool(vm, 5);
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    unsigned int color = getSlotColor(vm, 6);
+
+    blitFlippedRegion(dest, bitmap, x, y, flipX, flipY, true, color);
+}
+
+void bitmapBlitTransformed(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    double x = wrenGetSlotDouble(vm, 2);
+    double y = wrenGetSlotDouble(vm, 3);
+    double angle = wrenGetSlotDouble(vm, 4);
+    double scaleX = wrenGetSlotDouble(vm, 5);
+    double scaleY = wrenGetSlotDouble(vm, 6);
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    blitTransformedRegion(dest, bitmap, x, y, angle, scaleX, scaleY, FILTER_NEAREST, false, 0);
+}
+
+void bitmapBlitTransformed2(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    double x = wrenGetSlotDouble(vm, 2);
+    double y = wrenGetSlotDouble(vm, 3);
+    double angle = wrenGetSlotDouble(vm, 4);
+    double scaleX = wrenGetSlotDouble(vm, 5);
+    double scaleY = wrenGetSlotDouble(vm, 6);
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    Filter filter;
+    if (!getSlotFilter(vm, 7, &filter))
+        return;
+
+    blitTransformedRegion(dest, bitmap, x, y, angle, scaleX, scaleY, filter, false, 0);
+}
+
+void bitmapBlitTransformed3(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    double x = wrenGetSlotDouble(vm, 2);
+    double y = wrenGetSlotDouble(vm, 3);
+    double angle = wrenGetSlotDouble(vm, 4);
+    double scaleX = wrenGetSlotDouble(vm, 5);
+    double scaleY = wrenGetSlotDouble(vm, 6);
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    Filter filter;
+    if (!getSlotFilter(vm, 7, &filter))
+        return;
+
+    unsigned int color = getSlotColor(vm, 8);
+
+    blitTransformedRegion(dest, bitmap, x, y, angle, scaleX, scaleY, filter, true, color);
+}
+
+// Resizes smaller than this many output pixels run on the calling thread.
+#define RESIZE_SPLIT_PIXELS (256 * 256)
+
+static bool stringToResizeFilter(const char *str, stbir_filter *filter)
+{
+    if (strcmp(str, "default") == 0)
+        *filter = STBIR_FILTER_DEFAULT;
+    else if (strcmp(str, "nearest") == 0)
+        *filter = STBIR_FILTER_POINT_SAMPLE;
+    else if (strcmp(str, "bilinear") == 0)
+        *filter = STBIR_FILTER_TRIANGLE;
+    else if (strcmp(str, "box") == 0)
+        *filter = STBIR_FILTER_BOX;
+    else if (strcmp(str, "cubic") == 0)
+        *filter = STBIR_FILTER_CUBICBSPLINE;
+    else if (strcmp(str, "catmullrom") == 0)
+        *filter = STBIR_FILTER_CATMULLROM;
+    else if (strcmp(str, "mitchell") == 0)
+        *filter = STBIR_FILTER_MITCHELL;
+    else
+        return false;
+
+    return true;
+}
+
+static void resizeSplit(void *data, int index)
+{
+    stbir_resize_extended_split((STBIR_RESIZE *)data, index, 1);
+}
+
+// Resamples all of src into all of dst. Pixels are read as BGRA bytes with
+// straight alpha, so transparent pixels don't bleed their color into the
+// edges around them. Large outputs are cut into bands of rows that the job
+// pool resizes in parallel.
+static bool resizeBitmap(Bitmap *dst, Bitmap *src, stbir_filter filter)
+{
+    if (dst->width <= 0 || dst->height <= 0 || src->width <= 0 || src->height <= 0)
+        return true;
+
+    STBIR_RESIZE resize;
+    stbir_resize_init(&resize, src->buffer, src->width, src->height, src->pitch * sizeof(unsigned int),
+                      dst->buffer, dst->width, dst->height, dst->pitch * sizeof(unsigned int), STBIR_BGRA, STBIR_TYPE_UINT8);
+    stbir_set_edgemodes(&resize, STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP);
+    stbir_set_filters(&resize, filter, filter);
+
+    int splits = 1;
+    if (dst->width * dst->height >= RESIZE_SPLIT_PIXELS)
+        splits = jobsWorkerCount() + 1;
+
+    splits = stbir_build_samplers_with_splits(&resize, splits);
+    if (splits == 0)
+        return false;
+
+    jobsParallel(splits, resizeSplit, &resize);
+    stbir_free_samplers(&resize);
+
+    markDirty(dst, 0, 0, dst->width - 1, dst->height - 1);
+    return true;
+}
+
+static void resizeInto(WrenVM *vm, stbir_filter filter)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+
+    // stbir would read rows it has already written.
+    if (bitmapsOverlap(dest, bitmap))
+    {
+        wrenSetSlotString(vm, 0, "Cannot resize a bitmap into one it overlaps");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    if (!resizeBitmap(dest, bitmap, filter))
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+    }
+}
+
+void bitmapResizeInto(WrenVM *vm)
+{
+    resizeInto(vm, STBIR_FILTER_DEFAULT);
+}
+
+void bitmapResizeInto2(WrenVM *vm)
+{
+    stbir_filter filter;
+    if (!stringToResizeFilter(wrenGetSlotString(vm, 2), &filter))
+    {
+        wrenSetSlotString(vm, 0, "Invalid filter");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    resizeInto(vm, filter);
+}
+
+void bitmapBlur(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    double radius = wrenGetSlotDouble(vm, 1);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    if (!filterBlur(bitmap->buffer, bitmap->width, bitmap->height, bitmap->pitch, radius))
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    markDirty(bitmap, 0, 0, bitmap->width - 1, bitmap->height - 1);
+}
+
+void bitmapBoxBlur(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int radius = (int)wrenGetSlotDouble(vm, 1);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    if (!filterBoxBlur(bitmap->buffer, bitmap->width, bitmap->height, bitmap->pitch, radius))
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    markDirty(bitmap, 0, 0, bitmap->width - 1, bitmap->height - 1);
+}
+
+// Takes the kernel as a flat list of size * size weights, row by row.
+void bitmapConvolve(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+
+    int count = wrenGetListCount(vm, 1);
+    int size = (int)sqrt((double)count);
+    if (size * size != count || size % 2 == 0 || size > FILTER_MAX_KERNEL_SIZE)
+    {
+        wrenSetSlotString(vm, 0, "Kernel must be an odd square of weights up to 15x15");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    float kernel[FILTER_MAX_KERNEL_SIZE * FILTER_MAX_KERNEL_SIZE];
+
+    wrenEnsureSlots(vm, 3);
+    for (int i = 0; i < count; i++)
+    {
+        wrenGetListElement(vm, 1, i, 2);
+        kernel[i] = (float)wrenGetSlotDouble(vm, 2);
+    }
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    if (!filterConvolve(bitmap->buffer, bitmap->width, bitmap->height, bitmap->pitch, kernel, size))
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    markDirty(bitmap, 0, 0, bitmap->width - 1, bitmap->height - 1);
+}
+
+// Takes four rows of five numbers, for red, green, blue and alpha: the
+// weights of the red, green, blue and alpha inputs, then an offset in 0-255
+// units. Rows are turned into the per-byte columns raster.colorMatrix wants.
+void bitmapColorMatrix(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+
+    if (wrenGetListCount(vm, 1) != 20)
+    {
+        wrenSetSlotString(vm, 0, "Color matrix must have 20 entries");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    // Byte of each channel within a pixel, red to alpha.
+    static const int channelByte[4] = {2, 1, 0, 3};
+
+    float matrix[20];
+
+    wrenEnsureSlots(vm, 3);
+    for (int row = 0; row < 4; row++)
+    {
+        int out = channelByte[row];
+
+        for (int col = 0; col < 5; col++)
+        {
+            wrenGetListElement(vm, 1, row * 5 + col, 2);
+            float value = (float)wrenGetSlotDouble(vm, 2);
+
+            if (col < 4)
+                matrix[channelByte[col] * 4 + out] = value;
+            else
+                matrix[16 + out] = value;
+        }
+    }
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    filterColorMatrix(bitmap->buffer, bitmap->width, bitmap->height, bitmap->pitch, matrix);
+    markDirty(bitmap, 0, 0, bitmap->width - 1, bitmap->height - 1);
+}
+
+static bool stringToBlendMode(const char *str, BlendMode *mode)
+{
+    if (strcmp(str, "alpha") == 0)
+        *mode = BLEND_ALPHA;
+    else if (strcmp(str, "add") == 0)
+        *mode = BLEND_ADD;
+    else if (strcmp(str, "multiply") == 0)
+        *mode = BLEND_MULTIPLY;
+    else if (strcmp(str, "opacity") == 0)
+        *mode = BLEND_OPACITY;
+    else
+        return false;
+
+    return true;
+}
+
+static void blendRegion(Bitmap *dst, Bitmap *src, int dst_x, int dst_y, int src_x, int src_y, int src_width, int src_height, BlendMode mode, unsigned int opacity)
+{
     int dst_x1 = dst_x;
     int dst_y1 = dst_y;
     int dst_x2 = dst_x + src_width - 1;
@@ -390,71 +2547,2515 @@ void bitmapBlitRec(WrenVM *vm)
     int src_x1 = src_x;
     int src_y1 = src_y;
 
-    if (dst_x1 >= dst->width)
+    if (dst_x1 >= dst->width)
+        return;
+    if (dst_x2 < 0)
+        return;
+    if (dst_y1 >= dst->height)
+        return;
+    if (dst_y2 < 0)
+        return;
+
+    if (dst_x1 < 0)
+    {
+        src_x1 -= dst_x1;
+        dst_x1 = 0;
+    }
+    if (dst_y1 < 0)
+    {
+        src_y1 -= dst_y1;
+        dst_y1 = 0;
+    }
+    if (dst_x2 >= dst->width)
+        dst_x2 = dst->width - 1;
+    if (dst_y2 >= dst->height)
+        dst_y2 = dst->height - 1;
+
+    markDirty(dst, dst_x1, dst_y1, dst_x2, dst_y2);
+
+    int clipped_width = dst_x2 - dst_x1 + 1;
+    unsigned int *dst_pixel = dst->buffer + dst_y1 * dst->pitch + dst_x1;
+    unsigned int *src_pixel = src->buffer + src_y1 * src->pitch + src_x1;
+
+    // Same order as blitRegion when the pixels are shared with the source.
+    if (bitmapsOverlap(dst, src))
+    {
+        int rows = dst_y2 - dst_y1 + 1;
+        int pitch = dst->pitch;
+        if (dst_pixel > src_pixel)
+        {
+            dst_pixel += (rows - 1) * pitch;
+            src_pixel += (rows - 1) * pitch;
+            pitch = -pitch;
+        }
+
+        for (int i = 0; i < rows; i++)
+        {
+            blendOverlapping(dst_pixel, src_pixel, clipped_width, mode, opacity);
+            dst_pixel += pitch;
+            src_pixel += pitch;
+        }
+        return;
+    }
+
+    for (dst_y = dst_y1; dst_y <= dst_y2; dst_y++)
+    {
+        raster.blend(dst_pixel, src_pixel, clipped_width, mode, opacity);
+        dst_pixel += dst->pitch;
+        src_pixel += src->pitch;
+    }
+}
+
+static unsigned int getSlotOpacity(WrenVM *vm, int slot)
+{
+    double opacity = wrenGetSlotDouble(vm, slot);
+
+    if (opacity <= 0)
+        return 0;
+    if (opacity >= 255)
+        return 255;
+
+    return (unsigned int)opacity;
+}
+
+void bitmapBlend(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+    const char *modeName = wrenGetSlotString(vm, 4);
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    BlendMode mode;
+    if (!stringToBlendMode(modeName, &mode))
+    {
+        wrenSetSlotString(vm, 0, "Invalid blend mode");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    blendRegion(dest, bitmap, x, y, 0, 0, bitmap->width, bitmap->height, mode, 255);
+}
+
+void bitmapBlend2(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+    const char *modeName = wrenGetSlotString(vm, 4);
+    unsigned int opacity = getSlotOpacity(vm, 5);
+
+    if (!ownPixels(vm, dest))
+        return;
+
+    BlendMode mode;
+    if (!stringToBlendMode(modeName, &mode))
+    {
+        wrenSetSlotString(vm, 0, "Invalid blend mode");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    blendRegion(dest, bitmap, x, y, 0, 0, bitmap->width, bitmap->height, mode, opacity);
+}
+
+void bitmapBlendRec(WrenVM *vm)
+{
+    Bitmap *src = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dst = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int dst_x = (int)wrenGetSlotDouble(vm, 2);
+    int dst_y = (int)wrenGetSlotDouble(vm, 3);
+    int src_x = (int)wrenGetSlotDouble(vm, 4);
+    int src_y = (int)wrenGetSlotDouble(vm, 5);
+    int src_width = (int)wrenGetSlotDouble(vm, 6);
+    int src_height = (int)wrenGetSlotDouble(vm, 7);
+    const char *modeName = wrenGetSlotString(vm, 8);
+
+    if (!ownPixels(vm, dst))
+        return;
+
+    if (!checkRegion(vm, src, src_x, src_y, src_width, src_height))
+        return;
+
+    BlendMode mode;
+    if (!stringToBlendMode(modeName, &mode))
+    {
+        wrenSetSlotString(vm, 0, "Invalid blend mode");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    blendRegion(dst, src, dst_x, dst_y, src_x, src_y, src_width, src_height, mode, 255);
+}
+
+void bitmapBlendRec2(WrenVM *vm)
+{
+    Bitmap *src = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dst = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int dst_x = (int)wrenGetSlotDouble(vm, 2);
+    int dst_y = (int)wrenGetSlotDouble(vm, 3);
+    int src_x = (int)wrenGetSlotDouble(vm, 4);
+    int src_y = (int)wrenGetSlotDouble(vm, 5);
+    int src_width = (int)wrenGetSlotDouble(vm, 6);
+    int src_height = (int)wrenGetSlotDouble(vm, 7);
+    const char *modeName = wrenGetSlotString(vm, 8);
+    unsigned int opacity = getSlotOpacity(vm, 9);
+
+    if (!ownPixels(vm, dst))
+        return;
+
+    if (!checkRegion(vm, src, src_x, src_y, src_width, src_height))
+        return;
+
+    BlendMode mode;
+    if (!stringToBlendMode(modeName, &mode))
+    {
+        wrenSetSlotString(vm, 0, "Invalid blend mode");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    blendRegion(dst, src, dst_x, dst_y, src_x, src_y, src_width, src_height, mode, opacity);
+}
+
+static unsigned int r96_next_utf8_code_point(const char *data, unsigned int *index, unsigned int end)
+{
+    static const unsigned int utf8_offsets[6] = {
+        0x00000000UL, 0x00003080UL, 0x000E2080UL,
+        0x03C82080UL, 0xFA082080UL, 0x82082080UL};
+
+    unsigned int character = 0;
+    const unsigned char *bytes = (const unsigned char *)data;
+    int num_bytes = 0;
+    do
+    {
+        character <<= 6;
+        character += bytes[(*index)++];
+        num_bytes++;
+    } while (*index != end && ((bytes[*index]) & 0xC0) == 0x80);
+    character -= utf8_offsets[num_bytes - 1];
+
+    return character;
+}
+
+#define SHEET_GLYPHS 224
+
+// Cuts a glyph sheet into the cells of characters 32 to 255 and records the
+// runs of each cell that aren't the transparent key 0x0, so a glyph is drawn
+// with a few span copies instead of a key test per pixel. Cells that run past
+// the sheet get no spans.
+static bool buildSheetGlyphs(Font *font)
+{
+    Bitmap *sheet = &font->bitmap;
+    int width = font->glyphWidth;
+    int height = font->glyphHeight;
+    int perRow = width > 0 && height > 0 ? sheet->width / width : 0;
+
+    font->glyphs = (SheetGlyph *)malloc(SHEET_GLYPHS * sizeof(SheetGlyph));
+    if (font->glyphs == NULL)
+        return false;
+
+    // The first pass counts the spans, the second fills them in.
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int count = 0;
+        for (int i = 0; i < SHEET_GLYPHS; i++)
+        {
+            SheetGlyph *glyph = &font->glyphs[i];
+            glyph->srcX = perRow > 0 ? i % perRow * width : 0;
+            glyph->srcY = perRow > 0 ? i / perRow * height : 0;
+            glyph->spanStart = count;
+
+            if (perRow > 0 && glyph->srcY + height <= sheet->height)
+            {
+                for (int y = 0; y < height; y++)
+                {
+                    const unsigned int *src = sheet->buffer + (glyph->srcY + y) * sheet->pitch + glyph->srcX;
+
+                    int x = 0;
+                    while (x < width)
+                    {
+                        if (src[x] == 0x0)
+                        {
+                            x++;
+                            continue;
+                        }
+
+                        int start = x;
+                        while (x < width && src[x] != 0x0)
+                            x++;
+
+                        if (pass == 1)
+                        {
+                            GlyphSpan span = {start, y, x - start};
+                            font->spans[count] = span;
+                        }
+                        count++;
+                    }
+                }
+            }
+
+            glyph->spanCount = count - glyph->spanStart;
+        }
+
+        if (pass == 0)
+        {
+            font->spans = (GlyphSpan *)malloc((count > 0 ? count : 1) * sizeof(GlyphSpan));
+            if (font->spans == NULL)
+            {
+                free(font->glyphs);
+                font->glyphs = NULL;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Copies a span of glyph pixels tinted by raster.tint, which keeps their
+// alpha. A white tint would leave them as they are, so it's a plain copy.
+static void copyTinted(unsigned int *dst, const unsigned int *src, int count, unsigned int tint)
+{
+    if ((tint & 0x00FFFFFF) == 0x00FFFFFF)
+        raster.copy(dst, src, count);
+    else
+        raster.tint(dst, src, count, tint);
+}
+
+// Draws a sheet glyph with its top-left corner at (x, y). Glyphs wholly
+// inside the clip rect copy their spans as they are; the rest trim every
+// span to the clip rect first.
+static void drawSheetGlyph(Bitmap *dst, const Clip *clip, Font *font, const SheetGlyph *glyph, int x, int y, unsigned int tint)
+{
+    if (glyph->spanCount == 0)
+        return;
+
+    int x2 = x + font->glyphWidth - 1;
+    int y2 = y + font->glyphHeight - 1;
+    if (x > clip->x2 || y > clip->y2 || x2 < clip->x1 || y2 < clip->y1)
+        return;
+
+    const GlyphSpan *span = font->spans + glyph->spanStart;
+    const GlyphSpan *end = span + glyph->spanCount;
+    const unsigned int *src = font->bitmap.buffer + glyph->srcY * font->bitmap.pitch + glyph->srcX;
+    int srcPitch = font->bitmap.pitch;
+
+    if (x >= clip->x1 && y >= clip->y1 && x2 <= clip->x2 && y2 <= clip->y2)
+    {
+        markDirty(dst, x, y, x2, y2);
+
+        unsigned int *row = dst->buffer + y * dst->pitch + x;
+        for (; span < end; span++)
+            copyTinted(row + span->y * dst->pitch + span->x, src + span->y * srcPitch + span->x, span->length, tint);
+        return;
+    }
+
+    markDirtyClipped(dst, clip, x, y, x2, y2);
+
+    for (; span < end; span++)
+    {
+        int dy = y + span->y;
+        if (dy < clip->y1 || dy > clip->y2)
+            continue;
+
+        int sx = span->x;
+        int dx1 = x + sx;
+        int dx2 = dx1 + span->length - 1;
+        if (dx1 < clip->x1)
+        {
+            sx += clip->x1 - dx1;
+            dx1 = clip->x1;
+        }
+        if (dx2 > clip->x2)
+            dx2 = clip->x2;
+        if (dx1 > dx2)
+            continue;
+
+        copyTinted(dst->buffer + dy * dst->pitch + dx1, src + span->y * srcPitch + sx, dx2 - dx1 + 1, tint);
+    }
+}
+
+#define GLYPH_ATLAS_SIZE 1024
+#define GLYPH_SLOTS 4096
+#define MAX_TRUETYPE_SIZE 256
+
+struct TrueTypeFace
+{
+    char path[MAX_PATH_SIZE];
+    unsigned char *data;
+    stbtt_fontinfo info;
+    unsigned int id;
+    int refs;
+    struct TrueTypeFace *next;
+};
+
+static TrueTypeFace *faceHead = NULL;
+static unsigned int faceCount = 0;
+
+// Glyphs of every TrueType font share one coverage atlas, found through an
+// open addressing table keyed by face, size and code point. Glyphs can't be
+// taken out of a skyline one at a time, so when the atlas or the table fills
+// up every glyph is evicted at once and the atlas starts over.
+static unsigned char *glyphAtlas = NULL;
+static Packer glyphPacker;
+static CachedGlyph *glyphSlots = NULL;
+static int glyphCount = 0;
+static long long glyphArea = 0;
+static unsigned long long glyphHits = 0;
+static unsigned long long glyphMisses = 0;
+static unsigned long long glyphEvictions = 0;
+static unsigned long long glyphFlushes = 0;
+
+static TrueTypeFace *acquireFace(const char *path)
+{
+    for (TrueTypeFace *face = faceHead; face != NULL; face = face->next)
+    {
+        if (strcmp(face->path, path) == 0)
+        {
+            face->refs++;
+            return face;
+        }
+    }
+
+    unsigned char *data = (unsigned char *)readFile(path);
+    if (data == NULL)
+        return NULL;
+
+    TrueTypeFace *face = (TrueTypeFace *)malloc(sizeof(TrueTypeFace));
+    int offset = stbtt_GetFontOffsetForIndex(data, 0);
+    if (face == NULL || offset < 0 || !stbtt_InitFont(&face->info, data, offset))
+    {
+        free(face);
+        free(data);
+        return NULL;
+    }
+
+    snprintf(face->path, MAX_PATH_SIZE, "%s", path);
+    face->data = data;
+    face->id = ++faceCount;
+    face->refs = 1;
+    face->next = faceHead;
+    faceHead = face;
+    return face;
+}
+
+// Glyphs of a released face stay in the atlas until the next flush; face ids
+// are never reused, so they can't be found by another face.
+static void releaseFace(TrueTypeFace *face)
+{
+    if (--face->refs > 0)
+        return;
+
+    TrueTypeFace **link = &faceHead;
+    while (*link != face)
+        link = &(*link)->next;
+    *link = face->next;
+
+    free(face->data);
+    free(face);
+}
+
+static bool startGlyphCache(void)
+{
+    if (glyphAtlas != NULL)
+        return true;
+
+    glyphSlots = (CachedGlyph *)calloc(GLYPH_SLOTS, sizeof(CachedGlyph));
+    glyphAtlas = (unsigned char *)calloc(GLYPH_ATLAS_SIZE * GLYPH_ATLAS_SIZE, 1);
+    if (glyphSlots != NULL && glyphAtlas != NULL && skylineInit(&glyphPacker, GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE))
+        return true;
+
+    free(glyphSlots);
+    free(glyphAtlas);
+    glyphSlots = NULL;
+    glyphAtlas = NULL;
+    return false;
+}
+
+static void flushGlyphs(void)
+{
+    glyphEvictions += glyphCount;
+    glyphFlushes++;
+    glyphCount = 0;
+    glyphArea = 0;
+
+    memset(glyphSlots, 0, GLYPH_SLOTS * sizeof(CachedGlyph));
+    skylineReset(&glyphPacker);
+}
+
+static int glyphSlot(unsigned int face, int size, unsigned int codepoint)
+{
+    unsigned int hash = face * 0x9E3779B1u ^ (unsigned int)size * 0x85EBCA6Bu ^ codepoint * 0xC2B2AE35u;
+    hash ^= hash >> 15;
+    return (int)(hash & (GLYPH_SLOTS - 1));
+}
+
+// Returns the cached glyph for a code point, rasterizing it into the atlas the
+// first time it's drawn at this size. The pointer is only good until the next
+// lookup, which may flush the cache. Returns NULL if there's no memory.
+static CachedGlyph *trueTypeGlyph(Font *font, unsigned int codepoint)
+{
+    if (!startGlyphCache())
+        return NULL;
+
+    unsigned int id = font->face->id;
+    int slot = glyphSlot(id, font->pixelSize, codepoint);
+    while (glyphSlots[slot].face != 0)
+    {
+        CachedGlyph *glyph = &glyphSlots[slot];
+        if (glyph->face == id && glyph->size == font->pixelSize && glyph->codepoint == codepoint)
+        {
+            glyphHits++;
+            return glyph;
+        }
+
+        slot = (slot + 1) & (GLYPH_SLOTS - 1);
+    }
+
+    glyphMisses++;
+
+    // The table is kept at most three quarters full so probes stay short.
+    if (glyphCount >= GLYPH_SLOTS * 3 / 4)
+    {
+        flushGlyphs();
+        slot = glyphSlot(id, font->pixelSize, codepoint);
+    }
+
+    stbtt_fontinfo *info = &font->face->info;
+    int index = stbtt_FindGlyphIndex(info, (int)codepoint);
+
+    int advance, bearing;
+    stbtt_GetGlyphHMetrics(info, index, &advance, &bearing);
+
+    int x1, y1, x2, y2;
+    stbtt_GetGlyphBitmapBox(info, index, font->scale, font->scale, &x1, &y1, &x2, &y2);
+
+    int width = x2 - x1;
+    int height = y2 - y1;
+    int x = 0;
+    int y = 0;
+    if (width > 0 && height > 0 && !skylinePlace(&glyphPacker, width, height, &x, &y))
+    {
+        flushGlyphs();
+        slot = glyphSlot(id, font->pixelSize, codepoint);
+
+        if (!skylinePlace(&glyphPacker, width, height, &x, &y))
+            width = height = 0;
+    }
+
+    if (width > 0 && height > 0)
+    {
+        stbtt_MakeGlyphBitmap(info, glyphAtlas + y * GLYPH_ATLAS_SIZE + x, width, height, GLYPH_ATLAS_SIZE, font->scale, font->scale, index);
+        glyphArea += (long long)width * height;
+    }
+    else
+    {
+        width = height = 0;
+    }
+
+    CachedGlyph *glyph = &glyphSlots[slot];
+    glyph->face = id;
+    glyph->size = font->pixelSize;
+    glyph->codepoint = codepoint;
+    glyph->index = index;
+    glyph->x = x;
+    glyph->y = y;
+    glyph->width = width;
+    glyph->height = height;
+    glyph->offsetX = x1;
+    glyph->offsetY = y1;
+    glyph->advance = advance * font->scale;
+    glyphCount++;
+    return glyph;
+}
+
+static void blendGlyph(Bitmap *dst, const Clip *clip, CachedGlyph *glyph, int x, int y, unsigned int color)
+{
+    int x1 = MAX(x, clip->x1);
+    int y1 = MAX(y, clip->y1);
+    int x2 = MIN(x + glyph->width - 1, clip->x2);
+    int y2 = MIN(y + glyph->height - 1, clip->y2);
+    if (x1 > x2 || y1 > y2)
+        return;
+
+    markDirty(dst, x1, y1, x2, y2);
+
+    const unsigned char *src = glyphAtlas + (glyph->y + y1 - y) * GLYPH_ATLAS_SIZE + glyph->x + x1 - x;
+    unsigned int *row = dst->buffer + y1 * dst->pitch + x1;
+    for (int i = y1; i <= y2; i++)
+    {
+        raster.coverage(row, src, x2 - x1 + 1, color);
+        src += GLYPH_ATLAS_SIZE;
+        row += dst->pitch;
+    }
+}
+
+#define LAYOUT_CACHE_SLOTS 256
+
+static void releaseLayout(Layout *layout)
+{
+    if (layout == NULL || --layout->refs > 0)
+        return;
+
+    free(layout->text);
+    free(layout->glyphs);
+    free(layout->runs);
+    free(layout);
+}
+
+static void releaseLayouts(Font *font)
+{
+    if (font->layouts == NULL)
+        return;
+
+    for (int i = 0; i < LAYOUT_CACHE_SLOTS; i++)
+        releaseLayout(font->layouts[i]);
+
+    free(font->layouts);
+    font->layouts = NULL;
+}
+
+// FNV-1a over the bytes of text, mixed with a seed such as the wrap width of
+// a layout or the color of rendered text.
+static unsigned int hashText(const char *text, unsigned int seed)
+{
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *)text; *c != '\0'; c++)
+        hash = (hash ^ *c) * 16777619u;
+
+    hash ^= seed * 0x9E3779B1u;
+    hash ^= hash >> 15;
+    return hash;
+}
+
+static void pushRun(Layout *layout, int lineHeight, int glyphStart, int glyphEnd, int textStart, int textEnd, float width)
+{
+    LayoutRun *run = &layout->runs[layout->runCount];
+    run->glyphStart = glyphStart;
+    run->glyphCount = glyphEnd - glyphStart;
+    run->textStart = textStart;
+    run->textLength = textEnd - textStart;
+    run->y = layout->runCount * lineHeight;
+    run->width = (int)ceilf(width);
+
+    if (run->width > layout->width)
+        layout->width = run->width;
+
+    layout->runCount++;
+}
+
+// Breaks the text of a layout into runs and places their glyphs. With a wrap
+// width, a line that would grow past it ends at its last run of spaces, or
+// before the character that doesn't fit when there is none; the spaces stay
+// out of the width of the line. Newlines end a line, tabs move the pen by
+// three spaces and other control characters by one. Glyphs without pixels
+// only move the pen. Returns false if there's no memory.
+static bool buildLayout(Font *font, Layout *layout)
+{
+    const char *text = layout->text;
+    unsigned int length = (unsigned int)strlen(text);
+    int wrapWidth = layout->wrapWidth;
+    int lineHeight = font->glyphHeight;
+
+    // Every run but the last ends at a byte of the text, so neither array
+    // can outgrow it.
+    layout->glyphs = (LayoutGlyph *)malloc((length + 1) * sizeof(LayoutGlyph));
+    layout->runs = (LayoutRun *)malloc((length + 1) * sizeof(LayoutRun));
+    if (layout->glyphs == NULL || layout->runs == NULL)
+        return false;
+
+    stbtt_fontinfo *info = font->face != NULL ? &font->face->info : NULL;
+    bool kerning = info != NULL && (info->kern != 0 || info->gpos != 0);
+
+    int lineGlyph = 0;
+    int lineText = 0;
+    float pen = 0.0f;
+    int previous = -1;
+
+    // The last run of spaces on the line: the line can end at breakText,
+    // breakWidth wide, and the next one start at resumeText, with the glyphs
+    // from breakGlyph moved back by resumePen.
+    bool inSpaces = false;
+    bool canBreak = false;
+    int breakText = 0;
+    int breakGlyph = 0;
+    int resumeText = 0;
+    float breakWidth = 0.0f;
+    float resumePen = 0.0f;
+
+    unsigned int index = 0;
+    while (index < length)
+    {
+        int start = (int)index;
+        unsigned int c = r96_next_utf8_code_point(text, &index, length);
+
+        if (c == '\n')
+        {
+            pushRun(layout, lineHeight, lineGlyph, layout->glyphCount, lineText, start, pen);
+            lineGlyph = layout->glyphCount;
+            lineText = (int)index;
+            pen = 0.0f;
+            previous = -1;
+            inSpaces = false;
+            canBreak = false;
+            continue;
+        }
+
+        float advance = (float)font->glyphWidth;
+        float kern = 0.0f;
+        int glyphIndex = -1;
+        bool drawn = false;
+
+        if (c == '\t')
+        {
+            advance = 3.0f * font->glyphWidth;
+        }
+        else if (c >= 32 && info != NULL)
+        {
+            CachedGlyph *glyph = trueTypeGlyph(font, c);
+            if (glyph == NULL)
+                return false;
+
+            if (kerning && previous >= 0)
+                kern = font->scale * stbtt_GetGlyphKernAdvance(info, previous, glyph->index);
+
+            advance = glyph->advance;
+            glyphIndex = glyph->index;
+            drawn = glyph->width > 0;
+        }
+        else if (c >= 32 && c <= 255 && font->glyphs != NULL)
+        {
+            drawn = font->glyphs[c - 32].spanCount > 0;
+        }
+
+        if (c == ' ' || c == '\t')
+        {
+            if (!inSpaces)
+            {
+                breakText = start;
+                breakWidth = pen;
+            }
+            inSpaces = true;
+        }
+        else
+        {
+            if (inSpaces)
+            {
+                canBreak = true;
+                breakGlyph = layout->glyphCount;
+                resumeText = start;
+                resumePen = pen;
+                inSpaces = false;
+            }
+
+            if (wrapWidth > 0 && pen + kern + advance > wrapWidth && start > lineText)
+            {
+                if (canBreak && breakText > lineText)
+                {
+                    pushRun(layout, lineHeight, lineGlyph, breakGlyph, lineText, breakText, breakWidth);
+
+                    for (int i = breakGlyph; i < layout->glyphCount; i++)
+                    {
+                        layout->glyphs[i].x -= resumePen;
+                        layout->glyphs[i].y += lineHeight;
+                    }
+
+                    lineGlyph = breakGlyph;
+                    lineText = resumeText;
+                    pen -= resumePen;
+                }
+                canBreak = false;
+
+                // A word wider than the wrap width is broken where it overflows.
+                if (pen + kern + advance > wrapWidth && start > lineText)
+                {
+                    pushRun(layout, lineHeight, lineGlyph, layout->glyphCount, lineText, start, pen);
+                    lineGlyph = layout->glyphCount;
+                    lineText = start;
+                    pen = 0.0f;
+                    kern = 0.0f;
+                }
+            }
+        }
+
+        pen += kern;
+
+        if (drawn)
+        {
+            LayoutGlyph *glyph = &layout->glyphs[layout->glyphCount++];
+            glyph->x = pen;
+            glyph->y = layout->runCount * lineHeight;
+            glyph->codepoint = c;
+        }
+
+        pen += advance;
+        previous = glyphIndex;
+    }
+
+    pushRun(layout, lineHeight, lineGlyph, layout->glyphCount, lineText, (int)length, pen);
+    layout->height = layout->runCount * lineHeight;
+
+    return true;
+}
+
+// Returns the layout of text wrapped to wrapWidth, or unwrapped when it isn't
+// above zero, from the font's cache. Each slot keeps the last layout hashed to
+// it, so labels drawn every frame are only laid out once. Returns NULL if
+// there's no memory.
+static Layout *fontLayout(Font *font, const char *text, int wrapWidth)
+{
+    if (wrapWidth < 0)
+        wrapWidth = 0;
+
+    if (font->layouts == NULL)
+    {
+        font->layouts = (Layout **)calloc(LAYOUT_CACHE_SLOTS, sizeof(Layout *));
+        if (font->layouts == NULL)
+            return NULL;
+    }
+
+    unsigned int hash = hashText(text, (unsigned int)wrapWidth);
+    Layout **slot = &font->layouts[hash & (LAYOUT_CACHE_SLOTS - 1)];
+
+    Layout *layout = *slot;
+    if (layout != NULL && layout->hash == hash && layout->wrapWidth == wrapWidth && strcmp(layout->text, text) == 0)
+        return layout;
+
+    layout = (Layout *)calloc(1, sizeof(Layout));
+    if (layout == NULL)
+        return NULL;
+
+    size_t size = strlen(text) + 1;
+    layout->text = (char *)malloc(size);
+    layout->hash = hash;
+    layout->wrapWidth = wrapWidth;
+    layout->refs = 1;
+
+    if (layout->text == NULL)
+    {
+        releaseLayout(layout);
+        return NULL;
+    }
+
+    memcpy(layout->text, text, size);
+
+    if (!buildLayout(font, layout))
+    {
+        releaseLayout(layout);
+        return NULL;
+    }
+
+    releaseLayout(*slot);
+    *slot = layout;
+    return layout;
+}
+
+// Draws a layout with its top-left corner at (x, y). Sheet glyphs are tinted
+// by color and TrueType glyphs blended in it. Returns false if there's no
+// memory.
+static bool drawLayout(Bitmap *bitmap, const Clip *clip, Font *font, const Layout *layout, int x, int y, unsigned int color)
+{
+    const LayoutGlyph *glyph = layout->glyphs;
+    const LayoutGlyph *end = glyph + layout->glyphCount;
+
+    if (font->face != NULL)
+    {
+        for (; glyph < end; glyph++)
+        {
+            CachedGlyph *cached = trueTypeGlyph(font, glyph->codepoint);
+            if (cached == NULL)
+                return false;
+
+            blendGlyph(bitmap, clip, cached, x + (int)floorf(glyph->x + 0.5f) + cached->offsetX, y + glyph->y + font->ascent + cached->offsetY, color);
+        }
+    }
+    else if (font->glyphs != NULL)
+    {
+        for (; glyph < end; glyph++)
+            drawSheetGlyph(bitmap, clip, font, &font->glyphs[glyph->codepoint - 32], x + (int)glyph->x, y + glyph->y, color);
+    }
+
+    return true;
+}
+
+// Draws text with its top-left corner at (x, y). Sheet glyphs are tinted by
+// color and TrueType glyphs drawn in it.
+static void drawText(WrenVM *vm, Bitmap *bitmap, int x, int y, const char *text, Font *font, unsigned int color)
+{
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    Clip clip = bitmapClip(bitmap);
+
+    Layout *layout = fontLayout(font, text, 0);
+    if (layout == NULL || !drawLayout(bitmap, &clip, font, layout, x, y, color))
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+    }
+}
+
+void bitmapText(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    const char *text = wrenGetSlotString(vm, 3);
+    Font *font = (Font *)wrenGetSlotForeign(vm, 4);
+
+    drawText(vm, bitmap, x, y, text, font, 0xFFFFFFFF);
+}
+
+void bitmapText3(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    const char *text = wrenGetSlotString(vm, 3);
+    Font *font = (Font *)wrenGetSlotForeign(vm, 4);
+    unsigned int color = getSlotColor(vm, 5);
+
+    drawText(vm, bitmap, x, y, text, font, color);
+}
+
+void bitmapText2(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    TextLayout *text = (TextLayout *)wrenGetSlotForeign(vm, 3);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    Clip clip = bitmapClip(bitmap);
+
+    if (!drawLayout(bitmap, &clip, text->font, text->layout, x, y, 0xFFFFFFFF))
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+    }
+}
+
+static int compareDrawCommands(const void *a, const void *b)
+{
+    const DrawCommand *ca = (const DrawCommand *)a;
+    const DrawCommand *cb = (const DrawCommand *)b;
+
+    if (ca->bitmap != cb->bitmap)
+        return (size_t)ca->bitmap < (size_t)cb->bitmap ? -1 : 1;
+
+    return ca->order < cb->order ? -1 : ca->order > cb->order;
+}
+
+// Groups blits and glyphs by source bitmap. Clears and rectangles are
+// barriers, so only runs of blits between them are reordered and the frame
+// still layers the same way around them.
+static void sortDrawList(DrawList *list)
+{
+    int start = 0;
+    while (start < list->count)
+    {
+        int end = start;
+        while (end < list->count && list->commands[end].bitmap != NULL)
+            end++;
+
+        if (end - start > 1)
+            qsort(list->commands + start, end - start, sizeof(DrawCommand), compareDrawCommands);
+
+        start = end + 1;
+    }
+
+    list->needsSort = false;
+}
+
+static void runDrawCommand(Bitmap *bitmap, const Clip *clip, DrawCommand *command)
+{
+    switch (command->type)
+    {
+    case DRAW_CLEAR:
+        fillRegion(bitmap, clip, 0, 0, bitmap->width, bitmap->height, command->color);
+        break;
+    case DRAW_RECTANGLE:
+        fillRegion(bitmap, clip, command->x, command->y, command->width, command->height, command->color);
+        break;
+    case DRAW_BLIT:
+    case DRAW_BLIT_KEYED:
+        if (command->bitmap->buffer == NULL)
+            break;
+
+        blitRegion(bitmap, clip, command->bitmap, command->x, command->y, command->srcX, command->srcY, command->width, command->height, command->type == DRAW_BLIT_KEYED, command->color);
+        break;
+    case DRAW_GLYPH:
+        if (command->bitmap->buffer == NULL)
+            break;
+
+        drawSheetGlyph(bitmap, clip, command->font, command->glyph, command->x, command->y, command->color);
+        break;
+    }
+}
+
+#define TILE_SIZE 64
+
+typedef struct TileBins
+{
+    DrawList *list;
+    Bitmap *bitmap;
+    int tilesX;
+    int *starts;
+    int *items;
+} TileBins;
+
+static void drawTile(void *data, int index)
+{
+    TileBins *bins = (TileBins *)data;
+
+    int x1 = (index % bins->tilesX) * TILE_SIZE;
+    int y1 = (index / bins->tilesX) * TILE_SIZE;
+    Clip clip = {x1, y1, x1 + TILE_SIZE - 1, y1 + TILE_SIZE - 1};
+    if (clip.x2 >= bins->bitmap->width)
+        clip.x2 = bins->bitmap->width - 1;
+    if (clip.y2 >= bins->bitmap->height)
+        clip.y2 = bins->bitmap->height - 1;
+
+    for (int i = bins->starts[index]; i < bins->starts[index + 1]; i++)
+        runDrawCommand(bins->bitmap, &clip, &bins->list->commands[bins->items[i]]);
+}
+
+// Returns the pixels a command touches, clipped to the bitmap, or false if it
+// is off screen.
+static bool commandBounds(Bitmap *bitmap, DrawCommand *command, int *x1, int *y1, int *x2, int *y2)
+{
+    *x1 = 0;
+    *y1 = 0;
+    *x2 = bitmap->width - 1;
+    *y2 = bitmap->height - 1;
+
+    if (command->type != DRAW_CLEAR)
+    {
+        if (command->width <= 0 || command->height <= 0)
+            return false;
+
+        *x1 = command->x < 0 ? 0 : command->x;
+        *y1 = command->y < 0 ? 0 : command->y;
+        *x2 = command->x + command->width - 1;
+        *y2 = command->y + command->height - 1;
+        if (*x2 >= bitmap->width)
+            *x2 = bitmap->width - 1;
+        if (*y2 >= bitmap->height)
+            *y2 = bitmap->height - 1;
+    }
+
+    return *x1 <= *x2 && *y1 <= *y2;
+}
+
+// Returns the tile range a command touches, or false if it is off screen.
+static bool commandTiles(Bitmap *bitmap, DrawCommand *command, int *tx1, int *ty1, int *tx2, int *ty2)
+{
+    int x1, y1, x2, y2;
+    if (!commandBounds(bitmap, command, &x1, &y1, &x2, &y2))
+        return false;
+
+    *tx1 = x1 / TILE_SIZE;
+    *ty1 = y1 / TILE_SIZE;
+    *tx2 = x2 / TILE_SIZE;
+    *ty2 = y2 / TILE_SIZE;
+    return true;
+}
+
+// Bins every command into the screen tiles it touches, then rasterizes the
+// tiles in parallel. Each tile replays its commands in list order clipped to
+// the tile, so the result is identical to drawing the list on one thread.
+static bool executeDrawListTiled(DrawList *list, Bitmap *bitmap)
+{
+    int first = 0;
+    for (int i = 0; i < list->count; i++)
+    {
+        DrawCommand *command = &list->commands[i];
+
+        // A command reading from the target, or from a view sharing its
+        // pixels, could see tiles other threads have already drawn.
+        if (command->bitmap != NULL && bitmapsOverlap(command->bitmap, bitmap))
+            return false;
+
+        // Everything before the last clear is overwritten anyway.
+        if (command->type == DRAW_CLEAR)
+            first = i;
+    }
+
+    int tilesX = (bitmap->width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (bitmap->height + TILE_SIZE - 1) / TILE_SIZE;
+    int tileCount = tilesX * tilesY;
+
+    int *starts = (int *)calloc(tileCount + 1, sizeof(int));
+    if (starts == NULL)
+        return false;
+
+    int total = 0;
+    int tx1, ty1, tx2, ty2;
+    for (int i = first; i < list->count; i++)
+    {
+        if (!commandTiles(bitmap, &list->commands[i], &tx1, &ty1, &tx2, &ty2))
+            continue;
+
+        for (int ty = ty1; ty <= ty2; ty++)
+        {
+            for (int tx = tx1; tx <= tx2; tx++)
+                starts[ty * tilesX + tx + 1]++;
+        }
+
+        total += (tx2 - tx1 + 1) * (ty2 - ty1 + 1);
+    }
+
+    int *items = (int *)malloc((total > 0 ? total : 1) * sizeof(int));
+    int *fill = (int *)malloc(tileCount * sizeof(int));
+    if (items == NULL || fill == NULL)
+    {
+        free(starts);
+        free(items);
+        free(fill);
+        return false;
+    }
+
+    for (int i = 0; i < tileCount; i++)
+    {
+        starts[i + 1] += starts[i];
+        fill[i] = starts[i];
+    }
+
+    for (int i = first; i < list->count; i++)
+    {
+        if (!commandTiles(bitmap, &list->commands[i], &tx1, &ty1, &tx2, &ty2))
+            continue;
+
+        for (int ty = ty1; ty <= ty2; ty++)
+        {
+            for (int tx = tx1; tx <= tx2; tx++)
+                items[fill[ty * tilesX + tx]++] = i;
+        }
+    }
+
+    // Dirty rects are recorded here rather than by the kernels, which would
+    // race on them from several tiles at once.
+    int x1, y1, x2, y2;
+    for (int i = first; i < list->count; i++)
+    {
+        DrawCommand *command = &list->commands[i];
+
+        if (command->type == DRAW_CLEAR)
+            resetDirty(bitmap, command->color);
+        else if (commandBounds(bitmap, command, &x1, &y1, &x2, &y2))
+            markDirty(bitmap, x1, y1, x2, y2);
+    }
+
+    // Views the rects pass through already have changed set, so tiles only
+    // read it; tracking on the root is switched off while they draw.
+    int rootX = 0, rootY = 0;
+    Bitmap *root = rootBitmap(bitmap, &rootX, &rootY);
+    bool trackDirty = root->trackDirty;
+    root->trackDirty = false;
+
+    TileBins bins = {list, bitmap, tilesX, starts, items};
+    jobsParallel(tileCount, drawTile, &bins);
+
+    root->trackDirty = trackDirty;
+
+    free(starts);
+    free(items);
+    free(fill);
+
+    return true;
+}
+
+static void executeDrawList(DrawList *list, Bitmap *bitmap)
+{
+    if (list->sorted && list->needsSort)
+        sortDrawList(list);
+
+    if (list->tiled && jobsWorkerCount() > 0 && executeDrawListTiled(list, bitmap))
+        return;
+
+    Clip clip = bitmapClip(bitmap);
+    for (int i = 0; i < list->count; i++)
+    {
+        if (list->commands[i].type == DRAW_CLEAR)
+            clearBitmap(bitmap, list->commands[i].color);
+        else
+            runDrawCommand(bitmap, &clip, &list->commands[i]);
+    }
+}
+
+void bitmapDraw(WrenVM *vm)
+{
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 1);
+
+    if (!ownPixels(vm, bitmap))
+        return;
+
+    if (bitmap->buffer == NULL)
+        return;
+
+    executeDrawList(list, bitmap);
+}
+
+static void runImageJob(void *data)
+{
+    ImageJob *job = (ImageJob *)data;
+
+    unsigned int *buffer = loadImage(job->path, &job->width, &job->height);
+
+    mutexLock(imageMutex);
+
+    job->buffer = buffer;
+    job->done = true;
+
+    bool abandoned = job->abandoned;
+    condBroadcast(imageDone);
+    mutexUnlock(imageMutex);
+
+    if (abandoned)
+    {
+        poolFree(job->buffer, (size_t)job->width * job->height * sizeof(unsigned int));
+        free(job);
+    }
+}
+
+void bitmapLoadAllocate(WrenVM *vm)
+{
+    wrenEnsureSlots(vm, 1);
+    wrenSetSlotNewForeign(vm, 0, 0, sizeof(BitmapLoad));
+}
+
+void bitmapLoadFinalize(void *data)
+{
+    BitmapLoad *load = (BitmapLoad *)data;
+
+    if (load->bitmap != NULL)
+    {
+        dropHandle(load->bitmap);
+        load->bitmap = NULL;
+    }
+
+    if (load->job == NULL)
+        return;
+
+    mutexLock(imageMutex);
+
+    bool done = load->job->done;
+    load->job->abandoned = true;
+
+    mutexUnlock(imageMutex);
+
+    // A job still running frees itself when it finishes.
+    if (done)
+    {
+        poolFree(load->job->buffer, (size_t)load->job->width * load->job->height * sizeof(unsigned int));
+        free(load->job);
+    }
+
+    load->job = NULL;
+}
+
+// Queues the decode on the worker pool and returns at once. Without workers
+// the image is decoded right here.
+void bitmapLoadCreate(WrenVM *vm)
+{
+    BitmapLoad *load = (BitmapLoad *)wrenGetSlotForeign(vm, 0);
+    const char *path = wrenGetSlotString(vm, 1);
+
+    ImageJob *job = (ImageJob *)calloc(1, sizeof(ImageJob));
+    if (job == NULL || !startImageJobs())
+    {
+        free(job);
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    snprintf(job->path, MAX_PATH_SIZE, "%s/%s", basePath, path);
+    snprintf(load->path, MAX_PATH_SIZE, "%s", path);
+    load->job = job;
+
+    if (!jobsSubmit(runImageJob, job))
+        runImageJob(job);
+}
+
+void bitmapLoadPath(WrenVM *vm)
+{
+    BitmapLoad *load = (BitmapLoad *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotString(vm, 0, load->path);
+}
+
+static bool imageJobDone(ImageJob *job)
+{
+    mutexLock(imageMutex);
+    bool done = job->done;
+    mutexUnlock(imageMutex);
+
+    return done;
+}
+
+void bitmapLoadDone(WrenVM *vm)
+{
+    BitmapLoad *load = (BitmapLoad *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotBool(vm, 0, load->bitmap != NULL || imageJobDone(load->job));
+}
+
+void bitmapLoadError(WrenVM *vm)
+{
+    BitmapLoad *load = (BitmapLoad *)wrenGetSlotForeign(vm, 0);
+
+    if (load->bitmap == NULL && imageJobDone(load->job) && load->job->buffer == NULL)
+        wrenSetSlotString(vm, 0, "Error loading image");
+    else
+        wrenSetSlotNull(vm, 0);
+}
+
+// Blocks until the image is decoded, then hands its buffer to a new Bitmap.
+// Later calls return that same Bitmap.
+void bitmapLoadBitmap(WrenVM *vm)
+{
+    BitmapLoad *load = (BitmapLoad *)wrenGetSlotForeign(vm, 0);
+
+    if (load->bitmap != NULL)
+    {
+        wrenSetSlotHandle(vm, 0, load->bitmap->handle);
+        return;
+    }
+
+    ImageJob *job = load->job;
+
+    mutexLock(imageMutex);
+    while (!job->done)
+        condWait(imageDone, imageMutex);
+    mutexUnlock(imageMutex);
+
+    if (job->buffer == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error loading image");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    wrenEnsureSlots(vm, 2);
+    wrenGetVariable(vm, "basil", "Bitmap", 1);
+
+    Bitmap *bitmap = (Bitmap *)wrenSetSlotNewForeign(vm, 0, 1, sizeof(Bitmap));
+    bitmap->width = job->width;
+    bitmap->height = job->height;
+    bitmap->pitch = job->width;
+    bitmap->buffer = job->buffer;
+
+    // The buffer belongs to the new Bitmap either way, so without a handle to
+    // it the load can only fail from now on.
+    load->bitmap = holdHandle(vm, 0);
+    if (load->bitmap == NULL)
+    {
+        job->buffer = NULL;
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    load->job = NULL;
+    free(job);
+}
+
+static void runSaveJob(void *data)
+{
+    SaveJob *job = (SaveJob *)data;
+
+    bool saved = writeImage(job->path, job->format, job->pixels, job->width, job->height, job->width);
+    poolFree(job->pixels, (size_t)job->width * job->height * sizeof(unsigned int));
+
+    mutexLock(imageMutex);
+
+    job->pixels = NULL;
+    job->failed = !saved;
+    job->done = true;
+    pendingSaves--;
+
+    bool abandoned = job->abandoned;
+    condBroadcast(imageDone);
+    mutexUnlock(imageMutex);
+
+    if (abandoned)
+        free(job);
+}
+
+// Blocks until every save that was started has been written, so the process
+// doesn't exit halfway through a file.
+void waitForSaves(void)
+{
+    if (imageMutex == NULL)
+        return;
+
+    mutexLock(imageMutex);
+    while (pendingSaves > 0)
+        condWait(imageDone, imageMutex);
+    mutexUnlock(imageMutex);
+}
+
+void bitmapSaveAllocate(WrenVM *vm)
+{
+    wrenEnsureSlots(vm, 1);
+    wrenSetSlotNewForeign(vm, 0, 0, sizeof(BitmapSave));
+}
+
+void bitmapSaveFinalize(void *data)
+{
+    BitmapSave *save = (BitmapSave *)data;
+
+    if (save->job == NULL)
+        return;
+
+    mutexLock(imageMutex);
+
+    bool done = save->job->done;
+    save->job->abandoned = true;
+
+    mutexUnlock(imageMutex);
+
+    if (done)
+        free(save->job);
+
+    save->job = NULL;
+}
+
+// Snapshots the bitmap right away, so it can be drawn to again immediately,
+// and leaves encoding and writing to a worker.
+void bitmapSaveCreate(WrenVM *vm)
+{
+    BitmapSave *save = (BitmapSave *)wrenGetSlotForeign(vm, 0);
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    const char *path = wrenGetSlotString(vm, 2);
+
+    SaveJob *job = (SaveJob *)calloc(1, sizeof(SaveJob));
+    if (job == NULL || !startImageJobs())
+    {
+        free(job);
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    job->format = pathToImageFormat(path);
+    job->pixels = snapshotPixels(bitmap, formatWantsRgba(job->format));
+    if (job->pixels == NULL)
+    {
+        free(job);
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    snprintf(job->path, MAX_PATH_SIZE, "%s/%s", basePath, path);
+    job->width = bitmap->width;
+    job->height = bitmap->height;
+
+    snprintf(save->path, MAX_PATH_SIZE, "%s", path);
+    save->job = job;
+
+    mutexLock(imageMutex);
+    pendingSaves++;
+    mutexUnlock(imageMutex);
+
+    if (!jobsSubmit(runSaveJob, job))
+        runSaveJob(job);
+}
+
+void bitmapSavePath(WrenVM *vm)
+{
+    BitmapSave *save = (BitmapSave *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotString(vm, 0, save->path);
+}
+
+void bitmapSaveDone(WrenVM *vm)
+{
+    BitmapSave *save = (BitmapSave *)wrenGetSlotForeign(vm, 0);
+
+    mutexLock(imageMutex);
+    bool done = save->job->done;
+    mutexUnlock(imageMutex);
+
+    wrenSetSlotBool(vm, 0, done);
+}
+
+void bitmapSaveError(WrenVM *vm)
+{
+    BitmapSave *save = (BitmapSave *)wrenGetSlotForeign(vm, 0);
+
+    mutexLock(imageMutex);
+    bool failed = save->job->done && save->job->failed;
+    mutexUnlock(imageMutex);
+
+    if (failed)
+        wrenSetSlotString(vm, 0, "Error saving image");
+    else
+        wrenSetSlotNull(vm, 0);
+}
+
+void bitmapSaveWait(WrenVM *vm)
+{
+    BitmapSave *save = (BitmapSave *)wrenGetSlotForeign(vm, 0);
+
+    mutexLock(imageMutex);
+    while (!save->job->done)
+        condWait(imageDone, imageMutex);
+    bool failed = save->job->failed;
+    mutexUnlock(imageMutex);
+
+    if (failed)
+    {
+        wrenSetSlotString(vm, 0, "Error saving image");
+        wrenAbortFiber(vm, 0);
+    }
+}
+
+void fontAllocate(WrenVM *vm)
+{
+    wrenEnsureSlots(vm, 1);
+    wrenSetSlotNewForeign(vm, 0, 0, sizeof(Font));
+}
+
+// Lets go of the text rendered in a font. Entries that are still held become
+// stale and are freed on their last release.
+static void releaseRenderedText(Font *font)
+{
+    CachedImage *image = textCache.head;
+    while (image != NULL)
+    {
+        CachedImage *next = image->next;
+
+        if (image->font == font)
+        {
+            unlinkCachedImage(image);
+            if (image->refs == 0)
+                freeCachedImage(image);
+            else
+                image->stale = true;
+        }
+
+        image = next;
+    }
+}
+
+static void releaseFont(Font *font)
+{
+    releaseRenderedText(font);
+
+    if (font->face != NULL)
+    {
+        releaseFace(font->face);
+        font->face = NULL;
+    }
+    else if (font->bitmap.buffer != NULL)
+    {
+        releaseBitmap(&font->bitmap);
+    }
+
+    releaseLayouts(font);
+
+    free(font->glyphs);
+    free(font->spans);
+    font->glyphs = NULL;
+    font->spans = NULL;
+}
+
+void fontFinalize(void *data)
+{
+    releaseFont((Font *)data);
+}
+
+void fontCreate(WrenVM *vm)
+{
+    Font *font = (Font *)wrenGetSlotForeign(vm, 0);
+    const char *path = wrenGetSlotString(vm, 1);
+    int glyphWidth = (int)wrenGetSlotDouble(vm, 2);
+    int glyphHeight = (int)wrenGetSlotDouble(vm, 3);
+
+    // image loading
+
+    char fullPath[MAX_PATH_SIZE];
+    snprintf(fullPath, MAX_PATH_SIZE, "%s/%s", basePath, path);
+
+    if (!loadCachedBitmap(&font->bitmap, fullPath))
+    {
+        wrenSetSlotString(vm, 0, "Error loading image");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    font->glyphWidth = glyphWidth;
+    font->glyphHeight = glyphHeight;
+
+    if (!buildSheetGlyphs(font))
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+    }
+}
+
+void fontTrueType(WrenVM *vm)
+{
+    Font *font = (Font *)wrenGetSlotForeign(vm, 0);
+    const char *path = wrenGetSlotString(vm, 1);
+    int pixelSize = (int)wrenGetSlotDouble(vm, 2);
+
+    if (pixelSize < 1 || pixelSize > MAX_TRUETYPE_SIZE)
+    {
+        wrenSetSlotString(vm, 0, "Invalid font size");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    char fullPath[MAX_PATH_SIZE];
+    snprintf(fullPath, MAX_PATH_SIZE, "%s/%s", basePath, path);
+
+    TrueTypeFace *face = acquireFace(fullPath);
+    if (face == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error loading font");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    font->face = face;
+    font->pixelSize = pixelSize;
+    font->scale = stbtt_ScaleForPixelHeight(&face->info, (float)pixelSize);
+
+    int ascent, descent, lineGap;
+    stbtt_GetFontVMetrics(&face->info, &ascent, &descent, &lineGap);
+    font->ascent = (int)floorf(ascent * font->scale + 0.5f);
+    font->glyphHeight = (int)ceilf((ascent - descent + lineGap) * font->scale);
+
+    int advance, bearing;
+    stbtt_GetCodepointHMetrics(&face->info, ' ', &advance, &bearing);
+    font->glyphWidth = (int)floorf(advance * font->scale + 0.5f);
+}
+
+void fontDestroy(WrenVM *vm)
+{
+    Font *font = (Font *)wrenGetSlotForeign(vm, 0);
+
+    releaseFont(font);
+}
+
+// Returns the size of text as [width, height], height being a line per row.
+void fontMeasure(WrenVM *vm)
+{
+    Font *font = (Font *)wrenGetSlotForeign(vm, 0);
+    const char *text = wrenGetSlotString(vm, 1);
+
+    Layout *layout = fontLayout(font, text, 0);
+    if (layout == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    wrenEnsureSlots(vm, 2);
+    wrenSetSlotNewList(vm, 0);
+    wrenSetSlotDouble(vm, 1, layout->width);
+    wrenInsertInList(vm, 0, -1, 1);
+    wrenSetSlotDouble(vm, 1, layout->height);
+    wrenInsertInList(vm, 0, -1, 1);
+}
+
+// Returns the lines of text wrapped to width, without the spaces they were
+// broken at.
+void fontWrap(WrenVM *vm)
+{
+    Font *font = (Font *)wrenGetSlotForeign(vm, 0);
+    const char *text = wrenGetSlotString(vm, 1);
+    int width = (int)wrenGetSlotDouble(vm, 2);
+
+    Layout *layout = fontLayout(font, text, width);
+    if (layout == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    wrenEnsureSlots(vm, 2);
+    wrenSetSlotNewList(vm, 0);
+
+    for (int i = 0; i < layout->runCount; i++)
+    {
+        const LayoutRun *run = &layout->runs[i];
+        wrenSetSlotBytes(vm, 1, layout->text + run->textStart, run->textLength);
+        wrenInsertInList(vm, 0, -1, 1);
+    }
+}
+
+// Draws text into a new entry of the text cache, held once by the caller.
+// Returns NULL if there's no memory.
+static CachedImage *renderText(Font *font, const char *text, unsigned int color, unsigned int hash)
+{
+    Layout *layout = fontLayout(font, text, 0);
+    if (layout == NULL)
+        return NULL;
+
+    CachedImage *image = (CachedImage *)calloc(1, sizeof(CachedImage));
+    if (image == NULL)
+        return NULL;
+
+    size_t size = strlen(text) + 1;
+    image->text = (char *)malloc(size);
+    image->width = layout->width > 0 ? layout->width : 1;
+    image->height = layout->height > 0 ? layout->height : 1;
+    image->pixels = (unsigned int *)poolAlloc(cachedImageSize(image));
+    if (image->text == NULL || image->pixels == NULL)
+    {
+        freeCachedImage(image);
+        return NULL;
+    }
+
+    memcpy(image->text, text, size);
+
+    // TrueType glyphs blend color over the same color at zero alpha, which
+    // leaves their coverage as the alpha; sheet glyphs go on transparent black
+    // like the key they are cut from.
+    raster.fill(image->pixels, image->width * image->height, font->face != NULL ? color & 0x00FFFFFF : 0x0);
+
+    Bitmap target = {0};
+    target.width = image->width;
+    target.height = image->height;
+    target.pitch = image->width;
+    target.buffer = image->pixels;
+
+    Clip clip = bitmapClip(&target);
+    if (!drawLayout(&target, &clip, font, layout, 0, 0, color))
+    {
+        freeCachedImage(image);
+        return NULL;
+    }
+
+    image->font = font;
+    image->color = color;
+    image->hash = hash;
+    image->refs = 1;
+    image->lastUse = ++cacheClock;
+    linkCachedImage(image);
+
+    evictCachedImages(&textCache);
+    return image;
+}
+
+// Returns a Bitmap of text in color on a transparent background, to be drawn
+// with alpha blending. The pixels are shared through the text cache, so a
+// label rendered every frame is only drawn once and copied if it's drawn to.
+void fontRender(WrenVM *vm)
+{
+    Font *font = (Font *)wrenGetSlotForeign(vm, 0);
+    const char *text = wrenGetSlotString(vm, 1);
+    unsigned int color = getSlotColor(vm, 2);
+
+    unsigned int hash = hashText(text, color) ^ (unsigned int)(size_t)font * 0x85EBCA6Bu;
+
+    CachedImage *image = NULL;
+    for (CachedImage *entry = textSlots[hash & (TEXT_CACHE_SLOTS - 1)]; entry != NULL; entry = entry->chain)
+    {
+        if (entry->hash == hash && entry->font == font && entry->color == color && strcmp(entry->text, text) == 0)
+        {
+            image = entry;
+            break;
+        }
+    }
+
+    if (image != NULL)
+    {
+        image->refs++;
+        image->lastUse = ++cacheClock;
+        textCache.hits++;
+    }
+    else
+    {
+        textCache.misses++;
+
+        image = renderText(font, text, color, hash);
+        if (image == NULL)
+        {
+            wrenSetSlotString(vm, 0, "Error allocating buffer");
+            wrenAbortFiber(vm, 0);
+            return;
+        }
+    }
+
+    wrenEnsureSlots(vm, 2);
+    wrenGetVariable(vm, "basil", "Bitmap", 1);
+
+    Bitmap *bitmap = (Bitmap *)wrenSetSlotNewForeign(vm, 0, 1, sizeof(Bitmap));
+    bitmap->width = image->width;
+    bitmap->height = image->height;
+    bitmap->pitch = image->width;
+    bitmap->buffer = image->pixels;
+    bitmap->shared = image;
+}
+
+// Reports the text cache behind Font.render: lookups that found or had to
+// draw their text, the share of them that hit, entries dropped for the
+// budget, and the entries and bytes of pixels it holds.
+void fontRenderCacheStats(WrenVM *vm)
+{
+    int entries = 0;
+    for (CachedImage *image = textCache.head; image != NULL; image = image->next)
+        entries++;
+
+    unsigned long long lookups = textCache.hits + textCache.misses;
+
+    wrenEnsureSlots(vm, 3);
+    wrenSetSlotNewMap(vm, 0);
+
+    wrenSetSlotString(vm, 1, "hits");
+    wrenSetSlotDouble(vm, 2, (double)textCache.hits);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "misses");
+    wrenSetSlotDouble(vm, 2, (double)textCache.misses);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "hitRate");
+    wrenSetSlotDouble(vm, 2, lookups > 0 ? (double)textCache.hits / lookups : 0.0);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "evictions");
+    wrenSetSlotDouble(vm, 2, (double)textCache.evictions);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "entries");
+    wrenSetSlotDouble(vm, 2, entries);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "bytes");
+    wrenSetSlotDouble(vm, 2, (double)textCache.bytes);
+    wrenSetMapValue(vm, 0, 1, 2);
+}
+
+void fontRenderCacheBudget(WrenVM *vm)
+{
+    wrenSetSlotDouble(vm, 0, (double)textCache.budget);
+}
+
+void fontRenderCacheBudgetSet(WrenVM *vm)
+{
+    double budget = wrenGetSlotDouble(vm, 1);
+
+    textCache.budget = budget > 0 ? (size_t)budget : 0;
+    evictCachedImages(&textCache);
+}
+
+// Reports the shared TrueType glyph cache: glyphs held, the share of the
+// atlas they cover, lookups that found or had to rasterize a glyph, glyphs
+// evicted and the number of times the atlas started over.
+void fontGlyphCacheStats(WrenVM *vm)
+{
+    wrenEnsureSlots(vm, 3);
+    wrenSetSlotNewMap(vm, 0);
+
+    wrenSetSlotString(vm, 1, "glyphs");
+    wrenSetSlotDouble(vm, 2, glyphCount);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "occupancy");
+    wrenSetSlotDouble(vm, 2, (double)glyphArea / (GLYPH_ATLAS_SIZE * GLYPH_ATLAS_SIZE));
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "hits");
+    wrenSetSlotDouble(vm, 2, (double)glyphHits);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "misses");
+    wrenSetSlotDouble(vm, 2, (double)glyphMisses);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "evictions");
+    wrenSetSlotDouble(vm, 2, (double)glyphEvictions);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "flushes");
+    wrenSetSlotDouble(vm, 2, (double)glyphFlushes);
+    wrenSetMapValue(vm, 0, 1, 2);
+}
+
+void textLayoutAllocate(WrenVM *vm)
+{
+    wrenEnsureSlots(vm, 1);
+    wrenSetSlotNewForeign(vm, 0, 0, sizeof(TextLayout));
+}
+
+void textLayoutFinalize(void *data)
+{
+    TextLayout *text = (TextLayout *)data;
+
+    releaseLayout(text->layout);
+
+    if (text->fontHandle != NULL)
+        dropHandle(text->fontHandle);
+}
+
+// Takes a layout from the font's cache. It stays valid after the cache lets
+// go of it, and the font stays alive as long as the layout does.
+void textLayoutCreate(WrenVM *vm)
+{
+    TextLayout *text = (TextLayout *)wrenGetSlotForeign(vm, 0);
+    Font *font = (Font *)wrenGetSlotForeign(vm, 1);
+    const char *string = wrenGetSlotString(vm, 2);
+    int width = (int)wrenGetSlotDouble(vm, 3);
+
+    Layout *layout = fontLayout(font, string, width);
+    if (layout == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    HeldHandle *fontHandle = holdHandle(vm, 1);
+    if (fontHandle == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    layout->refs++;
+    text->layout = layout;
+    text->font = font;
+    text->fontHandle = fontHandle;
+}
+
+void textLayoutWidth(WrenVM *vm)
+{
+    TextLayout *text = (TextLayout *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotDouble(vm, 0, text->layout->width);
+}
+
+void textLayoutHeight(WrenVM *vm)
+{
+    TextLayout *text = (TextLayout *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotDouble(vm, 0, text->layout->height);
+}
+
+void textLayoutRunCount(WrenVM *vm)
+{
+    TextLayout *text = (TextLayout *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotDouble(vm, 0, text->layout->runCount);
+}
+
+// Returns a line of the layout as a map of its text, top, width and the
+// range of glyphs it holds.
+void textLayoutRun(WrenVM *vm)
+{
+    TextLayout *text = (TextLayout *)wrenGetSlotForeign(vm, 0);
+    int index = (int)wrenGetSlotDouble(vm, 1);
+
+    Layout *layout = text->layout;
+    if (index < 0 || index >= layout->runCount)
+    {
+        wrenSetSlotString(vm, 0, "Invalid run index");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    const LayoutRun *run = &layout->runs[index];
+
+    wrenEnsureSlots(vm, 3);
+    wrenSetSlotNewMap(vm, 0);
+
+    wrenSetSlotString(vm, 1, "text");
+    wrenSetSlotBytes(vm, 2, layout->text + run->textStart, run->textLength);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "y");
+    wrenSetSlotDouble(vm, 2, run->y);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "width");
+    wrenSetSlotDouble(vm, 2, run->width);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "glyphStart");
+    wrenSetSlotDouble(vm, 2, run->glyphStart);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "glyphCount");
+    wrenSetSlotDouble(vm, 2, run->glyphCount);
+    wrenSetMapValue(vm, 0, 1, 2);
+}
+
+void textLayoutGlyphCount(WrenVM *vm)
+{
+    TextLayout *text = (TextLayout *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotDouble(vm, 0, text->layout->glyphCount);
+}
+
+// Returns a glyph of the layout as [x, y, codepoint], x being the pen
+// position before rounding.
+void textLayoutGlyph(WrenVM *vm)
+{
+    TextLayout *text = (TextLayout *)wrenGetSlotForeign(vm, 0);
+    int index = (int)wrenGetSlotDouble(vm, 1);
+
+    Layout *layout = text->layout;
+    if (index < 0 || index >= layout->glyphCount)
+    {
+        wrenSetSlotString(vm, 0, "Invalid glyph index");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    const LayoutGlyph *glyph = &layout->glyphs[index];
+
+    wrenEnsureSlots(vm, 2);
+    wrenSetSlotNewList(vm, 0);
+    wrenSetSlotDouble(vm, 1, glyph->x);
+    wrenInsertInList(vm, 0, -1, 1);
+    wrenSetSlotDouble(vm, 1, glyph->y);
+    wrenInsertInList(vm, 0, -1, 1);
+    wrenSetSlotDouble(vm, 1, glyph->codepoint);
+    wrenInsertInList(vm, 0, -1, 1);
+}
+
+void drawListAllocate(WrenVM *vm)
+{
+    wrenEnsureSlots(vm, 1);
+    wrenSetSlotNewForeign(vm, 0, 0, sizeof(DrawList));
+}
+
+static void releaseDrawSources(DrawList *list)
+{
+    for (int i = 0; i < list->sourceCapacity; i++)
+    {
+        if (list->handles[i] != NULL)
+            dropHandle(list->handles[i]);
+    }
+
+    memset(list->sources, 0, list->sourceCapacity * sizeof(void *));
+    memset(list->handles, 0, list->sourceCapacity * sizeof(HeldHandle *));
+    list->sourceCount = 0;
+}
+
+void drawListFinalize(void *data)
+{
+    DrawList *list = (DrawList *)data;
+
+    if (list->commands == NULL)
+        return;
+
+    releaseDrawSources(list);
+
+    free(list->commands);
+    free(list->sources);
+    free(list->handles);
+    list->commands = NULL;
+}
+
+void drawListCreate(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+
+    list->count = 0;
+    list->capacity = 256;
+    list->sorted = false;
+    list->tiled = false;
+    list->needsSort = false;
+    list->sourceCount = 0;
+    list->sourceCapacity = 64;
+
+    list->commands = (DrawCommand *)malloc(list->capacity * sizeof(DrawCommand));
+    list->sources = (void **)calloc(list->sourceCapacity, sizeof(void *));
+    list->handles = (HeldHandle **)calloc(list->sourceCapacity, sizeof(HeldHandle *));
+    if (list->commands == NULL || list->sources == NULL || list->handles == NULL)
+    {
+        free(list->commands);
+        free(list->sources);
+        free(list->handles);
+        list->commands = NULL;
+
+        wrenSetSlotString(vm, 0, "Error allocating draw list");
+        wrenAbortFiber(vm, 0);
+    }
+}
+
+static int findDrawSource(void **sources, int capacity, void *object)
+{
+    unsigned int index = (unsigned int)(((size_t)object >> 4) * 2654435761u) & (capacity - 1);
+
+    while (sources[index] != NULL && sources[index] != object)
+        index = (index + 1) & (capacity - 1);
+
+    return index;
+}
+
+// Command bitmaps are only referenced by pointer, so the list holds one handle
+// per distinct source bitmap or font to keep it from being collected while
+// recorded.
+static bool retainDrawSource(WrenVM *vm, DrawList *list, int slot)
+{
+    void *object = wrenGetSlotForeign(vm, slot);
+
+    int index = findDrawSource(list->sources, list->sourceCapacity, object);
+    if (list->sources[index] == object)
+        return true;
+
+    if ((list->sourceCount + 1) * 2 > list->sourceCapacity)
+    {
+        int capacity = list->sourceCapacity * 2;
+        void **sources = (void **)calloc(capacity, sizeof(void *));
+        HeldHandle **handles = (HeldHandle **)calloc(capacity, sizeof(HeldHandle *));
+        if (sources == NULL || handles == NULL)
+        {
+            free(sources);
+            free(handles);
+            wrenSetSlotString(vm, 0, "Error allocating draw list");
+            wrenAbortFiber(vm, 0);
+            return false;
+        }
+
+        for (int i = 0; i < list->sourceCapacity; i++)
+        {
+            if (list->sources[i] == NULL)
+                continue;
+
+            int j = findDrawSource(sources, capacity, list->sources[i]);
+            sources[j] = list->sources[i];
+            handles[j] = list->handles[i];
+        }
+
+        free(list->sources);
+        free(list->handles);
+        list->sources = sources;
+        list->handles = handles;
+        list->sourceCapacity = capacity;
+
+        index = findDrawSource(list->sources, list->sourceCapacity, object);
+    }
+
+    HeldHandle *handle = holdHandle(vm, slot);
+    if (handle == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating draw list");
+        wrenAbortFiber(vm, 0);
+        return false;
+    }
+
+    list->sources[index] = object;
+    list->handles[index] = handle;
+    list->sourceCount++;
+
+    return true;
+}
+
+static DrawCommand *pushDrawCommand(WrenVM *vm, DrawList *list, DrawType type)
+{
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity * 2;
+        DrawCommand *commands = (DrawCommand *)realloc(list->commands, capacity * sizeof(DrawCommand));
+        if (commands == NULL)
+        {
+            wrenSetSlotString(vm, 0, "Error allocating draw list");
+            wrenAbortFiber(vm, 0);
+            return NULL;
+        }
+
+        list->commands = commands;
+        list->capacity = capacity;
+    }
+
+    DrawCommand *command = &list->commands[list->count];
+    command->type = type;
+    command->order = list->count;
+    command->bitmap = NULL;
+    list->count++;
+
+    if (type != DRAW_CLEAR && type != DRAW_RECTANGLE)
+        list->needsSort = true;
+
+    return command;
+}
+
+void drawListReset(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+
+    releaseDrawSources(list);
+    list->count = 0;
+    list->needsSort = false;
+}
+
+void drawListCount(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotDouble(vm, 0, list->count);
+}
+
+void drawListSorted(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotBool(vm, 0, list->sorted);
+}
+
+void drawListSortedSet(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+    bool sorted = wrenGetSlotBool(vm, 1);
+
+    list->sorted = sorted;
+}
+
+void drawListTiled(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotBool(vm, 0, list->tiled);
+}
+
+void drawListTiledSet(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+    bool tiled = wrenGetSlotBool(vm, 1);
+
+    list->tiled = tiled;
+}
+
+void drawListClear(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+
+    DrawCommand *command = pushDrawCommand(vm, list, DRAW_CLEAR);
+    if (command == NULL)
+        return;
+
+    command->color = getSlotColor(vm, 1);
+}
+
+void drawListRectangle(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    int w = (int)wrenGetSlotDouble(vm, 3);
+    int h = (int)wrenGetSlotDouble(vm, 4);
+
+    DrawCommand *command = pushDrawCommand(vm, list, DRAW_RECTANGLE);
+    if (command == NULL)
         return;
-    if (dst_x2 < 0)
+
+    command->x = x;
+    command->y = y;
+    command->width = w;
+    command->height = h;
+    command->color = getSlotColor(vm, 5);
+}
+
+void drawListBlit(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+
+    if (!retainDrawSource(vm, list, 1))
         return;
-    if (dst_y1 >= dst->height)
+
+    DrawCommand *command = pushDrawCommand(vm, list, DRAW_BLIT);
+    if (command == NULL)
         return;
-    if (dst_y2 < 0)
+
+    command->bitmap = bitmap;
+    command->x = x;
+    command->y = y;
+    command->srcX = 0;
+    command->srcY = 0;
+    command->width = bitmap->width;
+    command->height = bitmap->height;
+}
+
+void drawListBlit2(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+
+    if (!retainDrawSource(vm, list, 1))
         return;
 
-    if (dst_x1 < 0)
-    {
-        src_x1 -= dst_x1;
-        dst_x1 = 0;
-    }
-    if (dst_y1 < 0)
-    {
-        src_y1 -= dst_y1;
-        dst_y1 = 0;
-    }
-    if (dst_x2 >= dst->width)
-        dst_x2 = dst->width - 1;
-    if (dst_y2 >= dst->height)
-        dst_y2 = dst->height - 1;
+    DrawCommand *command = pushDrawCommand(vm, list, DRAW_BLIT_KEYED);
+    if (command == NULL)
+        return;
 
-    int clipped_width = dst_x2 - dst_x1 + 1;
-    int dst_next_row = dst->width - clipped_width;
-    int src_next_row = src->width - clipped_width;
-    unsigned int *dst_pixel = dst->buffer + dst_y1 * dst->width + dst_x1;
-    unsigned int *src_pixel = src->buffer + src_y1 * src->width + src_x1;
-    for (int y = dst_y1; y <= dst_y2; y++)
-    {
-        for (int i = 0; i < clipped_width; i++)
-            *dst_pixel++ = *src_pixel++;
+    command->bitmap = bitmap;
+    command->x = x;
+    command->y = y;
+    command->srcX = 0;
+    command->srcY = 0;
+    command->width = bitmap->width;
+    command->height = bitmap->height;
+    command->color = getSlotColor(vm, 4);
+}
 
-        dst_pixel += dst_next_row;
-        src_pixel += src_next_row;
-    }
+void drawListBlitRec(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+    Bitmap *src = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    int dst_x = (int)wrenGetSlotDouble(vm, 2);
+    int dst_y = (int)wrenGetSlotDouble(vm, 3);
+    int src_x = (int)wrenGetSlotDouble(vm, 4);
+    int src_y = (int)wrenGetSlotDouble(vm, 5);
+    int src_width = (int)wrenGetSlotDouble(vm, 6);
+    int src_height = (int)wrenGetSlotDouble(vm, 7);
+
+    if (!checkRegion(vm, src, src_x, src_y, src_width, src_height))
+        return;
+
+    if (!retainDrawSource(vm, list, 1))
+        return;
+
+    DrawCommand *command = pushDrawCommand(vm, list, DRAW_BLIT);
+    if (command == NULL)
+        return;
+
+    command->bitmap = src;
+    command->x = dst_x;
+    command->y = dst_y;
+    command->srcX = src_x;
+    command->srcY = src_y;
+    command->width = src_width;
+    command->height = src_height;
 }
 
-void bitmapBlitRec2(WrenVM *vm)
+void drawListBlitRec2(WrenVM *vm)
 {
-    Bitmap *src = (Bitmap *)wrenGetSlotForeign(vm, 0);
-    Bitmap *dst = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+    Bitmap *src = (Bitmap *)wrenGetSlotForeign(vm, 1);
     int dst_x = (int)wrenGetSlotDouble(vm, 2);
     int dst_y = (int)wrenGetSlotDouble(vm, 3);
     int src_x = (int)wrenGetSlotDouble(vm, 4);
     int src_y = (int)wrenGetSlotDouble(vm, 5);
     int src_width = (int)wrenGetSlotDouble(vm, 6);
     int src_height = (int)wrenGetSlotDouble(vm, 7);
-    Pixel *pixel = (Pixel *)wrenGetSlotForeign(vm, 8);
 
-    if (src_x + src_width - 1 >= src->width)
+    if (!checkRegion(vm, src, src_x, src_y, src_width, src_height))
+        return;
+
+    if (!retainDrawSource(vm, list, 1))
+        return;
+
+    DrawCommand *command = pushDrawCommand(vm, list, DRAW_BLIT_KEYED);
+    if (command == NULL)
+        return;
+
+    command->bitmap = src;
+    command->x = dst_x;
+    command->y = dst_y;
+    command->srcX = src_x;
+    command->srcY = src_y;
+    command->width = src_width;
+    command->height = src_height;
+    command->color = getSlotColor(vm, 8);
+}
+
+void drawListText(WrenVM *vm)
+{
+    DrawList *list = (DrawList *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    const char *text = wrenGetSlotString(vm, 3);
+    Font *font = (Font *)wrenGetSlotForeign(vm, 4);
+
+    // Glyph atlas rects can be reused by the time the list is drawn.
+    if (font->face != NULL)
     {
-        wrenSetSlotString(vm, 0, "Invalid bitmap coordinates");
+        wrenSetSlotString(vm, 0, "DrawList text needs a glyph sheet font");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    if (!retainDrawSource(vm, list, 4))
+        return;
+
+    if (font->glyphs == NULL)
+        return;
+
+    Layout *layout = fontLayout(font, text, 0);
+    if (layout == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
         wrenAbortFiber(vm, 0);
         return;
     }
 
-    if (src_y + src_height - 1 >= src->height)
+    for (int i = 0; i < layout->glyphCount; i++)
     {
-        wrenSetSlotString(vm, 0, "Invalid bitmap coordinates");
+        const LayoutGlyph *placed = &layout->glyphs[i];
+        const SheetGlyph *glyph = &font->glyphs[placed->codepoint - 32];
+
+        DrawCommand *command = pushDrawCommand(vm, list, DRAW_GLYPH);
+        if (command == NULL)
+            return;
+
+        command->bitmap = &font->bitmap;
+        command->font = font;
+        command->glyph = glyph;
+        command->x = x + (int)placed->x;
+        command->y = y + placed->y;
+        command->srcX = glyph->srcX;
+        command->srcY = glyph->srcY;
+        command->width = font->glyphWidth;
+        command->height = font->glyphHeight;
+        command->color = 0xFFFFFFFF;
+    }
+}
+
+void indexedBitmapAllocate(WrenVM *vm)
+{
+    wrenEnsureSlots(vm, 1);
+    wrenSetSlotNewForeign(vm, 0, 0, sizeof(IndexedBitmap));
+}
+
+void indexedBitmapFinalize(void *data)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)data;
+
+    poolFree(bitmap->buffer, (size_t)bitmap->width * bitmap->height);
+    bitmap->buffer = NULL;
+}
+
+void indexedBitmapCreate(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+    int width = (int)wrenGetSlotDouble(vm, 1);
+    int height = (int)wrenGetSlotDouble(vm, 2);
+
+    bitmap->width = width;
+    bitmap->height = height;
+    bitmap->changed = true;
+
+    // Start with a gray ramp so an image shows up before a palette is set.
+    for (int i = 0; i < 256; i++)
+        bitmap->palette[i] = 0xFF000000 | (i * 0x010101u);
+
+    bitmap->buffer = (unsigned char *)poolAlloc((size_t)width * height);
+    if (bitmap->buffer == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
         wrenAbortFiber(vm, 0);
         return;
     }
 
+    memset(bitmap->buffer, 0, (size_t)width * height);
+}
+
+void indexedBitmapDestroy(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+
+    poolFree(bitmap->buffer, (size_t)bitmap->width * bitmap->height);
+    bitmap->buffer = NULL;
+}
+
+void indexedBitmapWidth(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotDouble(vm, 0, bitmap->width);
+}
+
+void indexedBitmapHeight(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotDouble(vm, 0, bitmap->height);
+}
+
+void indexedBitmapGet(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+
+    if (x < 0 || x >= bitmap->width || y < 0 || y >= bitmap->height)
+    {
+        wrenSetSlotDouble(vm, 0, 0);
+        return;
+    }
+
+    wrenSetSlotDouble(vm, 0, bitmap->buffer[y * bitmap->width + x]);
+}
+
+void indexedBitmapSet(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    unsigned char index = (unsigned char)(int)wrenGetSlotDouble(vm, 3);
+
+    if (x < 0 || x >= bitmap->width || y < 0 || y >= bitmap->height)
+        return;
+
+    bitmap->buffer[y * bitmap->width + x] = index;
+    bitmap->changed = true;
+}
+
+void indexedBitmapClear(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+    unsigned char index = (unsigned char)(int)wrenGetSlotDouble(vm, 1);
+
+    memset(bitmap->buffer, index, bitmap->width * bitmap->height);
+    bitmap->changed = true;
+}
+
+void indexedBitmapRectangle(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+    int x = (int)wrenGetSlotDouble(vm, 1);
+    int y = (int)wrenGetSlotDouble(vm, 2);
+    int w = (int)wrenGetSlotDouble(vm, 3);
+    int h = (int)wrenGetSlotDouble(vm, 4);
+    unsigned char index = (unsigned char)(int)wrenGetSlotDouble(vm, 5);
+
+    int x2 = x + w - 1;
+    int y2 = y + h - 1;
+    if (x < 0)
+        x = 0;
+    if (y < 0)
+        y = 0;
+    if (x2 >= bitmap->width)
+        x2 = bitmap->width - 1;
+    if (y2 >= bitmap->height)
+        y2 = bitmap->height - 1;
+    if (x > x2 || y > y2)
+        return;
+
+    for (int i = y; i <= y2; i++)
+        memset(bitmap->buffer + i * bitmap->width + x, index, x2 - x + 1);
+
+    bitmap->changed = true;
+}
+
+static void blitIndexedRegion(IndexedBitmap *dst, IndexedBitmap *src, int dst_x, int dst_y, int src_x, int src_y, int src_width, int src_height, bool keyed, unsigned char key)
+{
     int dst_x1 = dst_x;
     int dst_y1 = dst_y;
     int dst_x2 = dst_x + src_width - 1;
@@ -486,223 +5087,254 @@ void bitmapBlitRec2(WrenVM *vm)
     if (dst_y2 >= dst->height)
         dst_y2 = dst->height - 1;
 
-    unsigned int color = (pixel->a << 24) | (pixel->r << 16) | (pixel->g << 8) | pixel->b;
-
     int clipped_width = dst_x2 - dst_x1 + 1;
-    int dst_next_row = dst->width - clipped_width;
-    int src_next_row = src->width - clipped_width;
-    unsigned int *dst_pixel = dst->buffer + dst_y1 * dst->width + dst_x1;
-    unsigned int *src_pixel = src->buffer + src_y1 * src->width + src_x1;
+    unsigned char *dst_pixel = dst->buffer + dst_y1 * dst->width + dst_x1;
+    unsigned char *src_pixel = src->buffer + src_y1 * src->width + src_x1;
     for (dst_y = dst_y1; dst_y <= dst_y2; dst_y++)
     {
-        for (int i = 0; i < clipped_width; i++)
-        {
-            unsigned int src_color = *src_pixel;
-            unsigned int dst_color = *dst_pixel;
-            *dst_pixel = src_color != color ? src_color : dst_color;
-            src_pixel++;
-            dst_pixel++;
-        }
+        if (keyed)
+            raster.copyKeyed8(dst_pixel, src_pixel, clipped_width, key);
+        else
+            memcpy(dst_pixel, src_pixel, clipped_width);
 
-        dst_pixel += dst_next_row;
-        src_pixel += src_next_row;
+        dst_pixel += dst->width;
+        src_pixel += src->width;
     }
+
+    dst->changed = true;
 }
 
-static unsigned int r96_next_utf8_code_point(const char *data, unsigned int *index, unsigned int end)
+void indexedBitmapBlit(WrenVM *vm)
 {
-    static const unsigned int utf8_offsets[6] = {
-        0x00000000UL, 0x00003080UL, 0x000E2080UL,
-        0x03C82080UL, 0xFA082080UL, 0x82082080UL};
-
-    unsigned int character = 0;
-    const unsigned char *bytes = (const unsigned char *)data;
-    int num_bytes = 0;
-    do
-    {
-        character <<= 6;
-        character += bytes[(*index)++];
-        num_bytes++;
-    } while (*index != end && ((bytes[*index]) & 0xC0) == 0x80);
-    character -= utf8_offsets[num_bytes - 1];
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+    IndexedBitmap *dest = (IndexedBitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
 
-    return character;
+    blitIndexedRegion(dest, bitmap, x, y, 0, 0, bitmap->width, bitmap->height, false, 0);
 }
 
-#define R96_ARGB(alpha, red, green, blue) (uint32_t)(((uint8_t)(alpha) << 24) | ((uint8_t)(red) << 16) | ((uint8_t)(green) << 8) | (uint8_t)(blue))
-#define R96_A(color) ((uint8_t)(color >> 24))
-#define R96_R(color) ((uint8_t)(color >> 16))
-#define R96_G(color) ((uint8_t)(color >> 8))
-#define R96_B(color) ((uint8_t)(color))
+void indexedBitmapBlit2(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+    IndexedBitmap *dest = (IndexedBitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+    unsigned char key = (unsigned char)(int)wrenGetSlotDouble(vm, 4);
+
+    blitIndexedRegion(dest, bitmap, x, y, 0, 0, bitmap->width, bitmap->height, true, key);
+}
 
-void r96_blit_region_keyed_tinted(Bitmap *dst, Bitmap *src, int dst_x, int dst_y, int src_x, int src_y, int src_width, int src_height, unsigned int color_key, unsigned int tint)
+void indexedBitmapBlitRec(WrenVM *vm)
 {
-    int dst_x1 = dst_x;
-    int dst_y1 = dst_y;
-    int dst_x2 = dst_x + src_width - 1;
-    int dst_y2 = dst_y + src_height - 1;
-    int src_x1 = src_x;
-    int src_y1 = src_y;
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+    IndexedBitmap *dest = (IndexedBitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+    int srcX = (int)wrenGetSlotDouble(vm, 4);
+    int srcY = (int)wrenGetSlotDouble(vm, 5);
+    int width = (int)wrenGetSlotDouble(vm, 6);
+    int height = (int)wrenGetSlotDouble(vm, 7);
 
-    if (dst_x1 >= dst->width)
-        return;
-    if (dst_x2 < 0)
-        return;
-    if (dst_y1 >= dst->height)
+    if (!checkBounds(vm, bitmap->width, bitmap->height, srcX, srcY, width, height))
         return;
-    if (dst_y2 < 0)
+
+    blitIndexedRegion(dest, bitmap, x, y, srcX, srcY, width, height, false, 0);
+}
+
+void indexedBitmapBlitRec2(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+    IndexedBitmap *dest = (IndexedBitmap *)wrenGetSlotForeign(vm, 1);
+    int x = (int)wrenGetSlotDouble(vm, 2);
+    int y = (int)wrenGetSlotDouble(vm, 3);
+    int srcX = (int)wrenGetSlotDouble(vm, 4);
+    int srcY = (int)wrenGetSlotDouble(vm, 5);
+    int width = (int)wrenGetSlotDouble(vm, 6);
+    int height = (int)wrenGetSlotDouble(vm, 7);
+    unsigned char key = (unsigned char)(int)wrenGetSlotDouble(vm, 8);
+
+    if (!checkBounds(vm, bitmap->width, bitmap->height, srcX, srcY, width, height))
         return;
 
-    if (dst_x1 < 0)
-    {
-        src_x1 -= dst_x1;
-        dst_x1 = 0;
-    }
-    if (dst_y1 < 0)
+    blitIndexedRegion(dest, bitmap, x, y, srcX, srcY, width, height, true, key);
+}
+
+static bool getSlotPaletteIndex(WrenVM *vm, int slot, int *index)
+{
+    *index = (int)wrenGetSlotDouble(vm, slot);
+    if (*index < 0 || *index > 255)
     {
-        src_y1 -= dst_y1;
-        dst_y1 = 0;
+        wrenSetSlotString(vm, 0, "Invalid palette index");
+        wrenAbortFiber(vm, 0);
+        return false;
     }
-    if (dst_x2 >= dst->width)
-        dst_x2 = dst->width - 1;
-    if (dst_y2 >= dst->height)
-        dst_y2 = dst->height - 1;
 
-    unsigned int tint_r = R96_R(tint);
-    unsigned int tint_g = R96_G(tint);
-    unsigned int tint_b = R96_B(tint);
+    return true;
+}
+
+void indexedBitmapPalette(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+
+    int index;
+    if (!getSlotPaletteIndex(vm, 1, &index))
+        return;
+
+    wrenSetSlotDouble(vm, 0, bitmap->palette[index]);
+}
+
+void indexedBitmapSetPalette(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+
+    int index;
+    if (!getSlotPaletteIndex(vm, 1, &index))
+        return;
+
+    bitmap->palette[index] = getSlotColor(vm, 2);
+    bitmap->changed = true;
+}
+
+// Rotates the palette entries [first, first + count) by shift places towards
+// higher indices, the classic color cycling effect.
+void indexedBitmapRotatePalette(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+    int first = (int)wrenGetSlotDouble(vm, 1);
+    int count = (int)wrenGetSlotDouble(vm, 2);
+    int shift = (int)wrenGetSlotDouble(vm, 3);
 
-    int clipped_width = dst_x2 - dst_x1 + 1;
-    int dst_next_row = dst->width - clipped_width;
-    int src_next_row = src->width - clipped_width;
-    unsigned int *dst_pixel = dst->buffer + dst_y1 * dst->width + dst_x1;
-    unsigned int *src_pixel = src->buffer + src_y1 * src->width + src_x1;
-    for (dst_y = dst_y1; dst_y <= dst_y2; dst_y++)
+    if (first < 0 || count < 0 || first + count > 256)
     {
-        for (int i = 0; i < clipped_width; i++)
-        {
-            unsigned int src_color = *src_pixel;
-            unsigned int dst_color = *dst_pixel;
-            *dst_pixel = src_color != color_key ? R96_ARGB(
-                                                      R96_A(src_color),
-                                                      ((R96_R(src_color) * tint_r) >> 8) & 0xff,
-                                                      ((R96_G(src_color) * tint_g) >> 8) & 0xff,
-                                                      ((R96_B(src_color) * tint_b) >> 8) & 0xff)
-                                                : dst_color;
-            src_pixel++;
-            dst_pixel++;
-        }
-        dst_pixel += dst_next_row;
-        src_pixel += src_next_row;
+        wrenSetSlotString(vm, 0, "Invalid palette index");
+        wrenAbortFiber(vm, 0);
+        return;
     }
+    if (count == 0)
+        return;
+
+    shift %= count;
+    if (shift < 0)
+        shift += count;
+
+    unsigned int rotated[256];
+    for (int i = 0; i < count; i++)
+        rotated[(i + shift) % count] = bitmap->palette[first + i];
+
+    memcpy(bitmap->palette + first, rotated, count * sizeof(unsigned int));
+    bitmap->changed = true;
 }
 
-void bitmapText(WrenVM *vm)
+void indexedBitmapCopyFrom(WrenVM *vm)
 {
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 0);
-    const char *text = wrenGetSlotString(vm, 1);
-    int x = (int)wrenGetSlotDouble(vm, 2);
-    int y = (int)wrenGetSlotDouble(vm, 3);
-    Font *font = (Font *)wrenGetSlotForeign(vm, 4);
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
 
-    int cursor_x = x;
-    int cursor_y = y;
-    unsigned int text_length = (int)strlen(text);
-    unsigned int index = 0;
-    while (index < text_length)
-    {
-        unsigned int c = r96_next_utf8_code_point(text, &index, text_length);
-        if (c == '\t')
-        {
-            cursor_x += 3 * font->glyphWidth;
-            continue;
-        }
-        if (c == '\n')
-        {
-            cursor_x = x;
-            cursor_y += font->glyphHeight;
-            continue;
-        }
-        if (c < 32 || c > 255)
-        {
-            cursor_x += font->glyphWidth;
-            continue;
-        }
+    int length;
+    const char *bytes = wrenGetSlotBytes(vm, 1, &length);
+
+    if (!checkBytes(vm, length, bitmap->width * bitmap->height))
+        return;
 
-        int glyphsPerRow = font->bitmap.width / font->glyphWidth;
+    memcpy(bitmap->buffer, bytes, length);
+    bitmap->changed = true;
+}
 
-        int glyph_index = c - 32;
-        int glyph_x = (glyph_index % glyphsPerRow);
-        int glyph_y = (glyph_index - glyph_x) / glyphsPerRow;
-        glyph_x *= font->glyphWidth;
-        glyph_y *= font->glyphHeight;
+// Writes the ARGB version of the bitmap into a Bitmap of the same size.
+void indexedBitmapExpand(WrenVM *vm)
+{
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 0);
+    Bitmap *dest = (Bitmap *)wrenGetSlotForeign(vm, 1);
 
-        r96_blit_region_keyed_tinted(bitmap, &font->bitmap, cursor_x, cursor_y, glyph_x, glyph_y, font->glyphWidth, font->glyphHeight, 0x0, 0xFFFFFFFF);
+    if (!ownPixels(vm, dest))
+        return;
 
-        cursor_x += font->glyphWidth;
+    if (dest->width != bitmap->width || dest->height != bitmap->height)
+    {
+        wrenSetSlotString(vm, 0, "Bitmap sizes do not match");
+        wrenAbortFiber(vm, 0);
+        return;
     }
+
+    for (int y = 0; y < bitmap->height; y++)
+        raster.lookup(dest->buffer + y * dest->pitch, bitmap->buffer + y * bitmap->width, bitmap->width, bitmap->palette);
+    markDirty(dest, 0, 0, dest->width - 1, dest->height - 1);
 }
 
-void fontAllocate(WrenVM *vm)
+void packerAllocate(WrenVM *vm)
 {
     wrenEnsureSlots(vm, 1);
-    wrenSetSlotNewForeign(vm, 0, 0, sizeof(Font));
+    wrenSetSlotNewForeign(vm, 0, 0, sizeof(Packer));
 }
 
-void fontFinalize(void *data)
+void packerFinalize(void *data)
 {
-    Font *font = (Font *)data;
-
-    if (font->bitmap.buffer == NULL)
-        return;
+    Packer *packer = (Packer *)data;
 
-    free(font->bitmap.buffer);
-    font->bitmap.buffer = NULL;
+    skylineFree(packer);
 }
 
-void fontCreate(WrenVM *vm)
+void packerCreate(WrenVM *vm)
 {
-    Font *font = (Font *)wrenGetSlotForeign(vm, 0);
-    const char *path = wrenGetSlotString(vm, 1);
-    int glyphWidth = (int)wrenGetSlotDouble(vm, 2);
-    int glyphHeight = (int)wrenGetSlotDouble(vm, 3);
-
-    // image loading
-
-    char fullPath[MAX_PATH_SIZE];
-    snprintf(fullPath, MAX_PATH_SIZE, "%s/%s", basePath, path);
+    Packer *packer = (Packer *)wrenGetSlotForeign(vm, 0);
+    int width = (int)wrenGetSlotDouble(vm, 1);
+    int height = (int)wrenGetSlotDouble(vm, 2);
 
-    font->bitmap.buffer = (unsigned int *)stbi_load(fullPath, &font->bitmap.width, &font->bitmap.height, NULL, 4);
-    if (font->bitmap.buffer == NULL)
+    if (width <= 0 || height <= 0)
     {
-        wrenSetSlotString(vm, 0, "Error loading image");
+        wrenSetSlotString(vm, 0, "Invalid packer size");
         wrenAbortFiber(vm, 0);
         return;
     }
 
-    unsigned char *bytes = (unsigned char *)font->bitmap.buffer;
-    int n = font->bitmap.width * font->bitmap.height * 4;
-
-    for (int i = 0; i < n; i += 4)
+    if (!skylineInit(packer, width, height))
     {
-        unsigned char b = bytes[i];
-        bytes[i] = bytes[i + 2];
-        bytes[i + 2] = b;
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
     }
+}
 
-    font->glyphWidth = glyphWidth;
-    font->glyphHeight = glyphHeight;
+void packerWidth(WrenVM *vm)
+{
+    Packer *packer = (Packer *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotDouble(vm, 0, packer->width);
 }
 
-void fontDestroy(WrenVM *vm)
+void packerHeight(WrenVM *vm)
 {
-    Font *font = (Font *)wrenGetSlotForeign(vm, 0);
+    Packer *packer = (Packer *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotDouble(vm, 0, packer->height);
+}
+
+// Returns the [x, y] a rectangle was placed at, or null when it doesn't fit.
+void packerInsert(WrenVM *vm)
+{
+    Packer *packer = (Packer *)wrenGetSlotForeign(vm, 0);
+    int width = (int)wrenGetSlotDouble(vm, 1);
+    int height = (int)wrenGetSlotDouble(vm, 2);
 
-    if (font->bitmap.buffer == NULL)
+    int x, y;
+    if (!skylinePlace(packer, width, height, &x, &y))
+    {
+        wrenSetSlotNull(vm, 0);
         return;
+    }
+
+    wrenEnsureSlots(vm, 2);
+    wrenSetSlotNewList(vm, 0);
+    wrenSetSlotDouble(vm, 1, x);
+    wrenInsertInList(vm, 0, -1, 1);
+    wrenSetSlotDouble(vm, 1, y);
+    wrenInsertInList(vm, 0, -1, 1);
+}
 
-    free(font->bitmap.buffer);
-    font->bitmap.buffer = NULL;
+void packerReset(WrenVM *vm)
+{
+    Packer *packer = (Packer *)wrenGetSlotForeign(vm, 0);
+
+    skylineReset(packer);
 }
 
 void osName(WrenVM *vm)
@@ -778,6 +5410,12 @@ void osReadLine(WrenVM *vm)
     wrenSetSlotString(vm, 0, result);
 }
 
+void osSimd(WrenVM *vm)
+{
+    wrenEnsureSlots(vm, 1);
+    wrenSetSlotString(vm, 0, raster.name);
+}
+
 void pixelAllocate(WrenVM *vm)
 {
     wrenEnsureSlots(vm, 1);
@@ -911,6 +5549,149 @@ void windowAllocate(WrenVM *vm)
     wrenSetSlotNewForeign(vm, 0, 0, sizeof(Window));
 }
 
+// Writes the frame in slot to disk. Runs on the recording thread.
+static bool writeRecordedFrame(Recording *recording, int slot)
+{
+    int size = recording->width * recording->height;
+    unsigned int *pixels = recording->slots + (size_t)slot * size;
+
+    if (recording->format == RECORD_RAW)
+        return fwrite(pixels, sizeof(unsigned int), size, recording->raw) == (size_t)size;
+
+    char path[MAX_PATH_SIZE];
+    const char *ext = recording->format == RECORD_QOI ? "qoi" : "png";
+    snprintf(path, MAX_PATH_SIZE, "%s/frame_%06llu.%s", recording->dir, recording->numbers[slot], ext);
+
+    if (recording->format == RECORD_QOI)
+        return qoiWrite(path, pixels, recording->width, recording->height, recording->width);
+
+    raster.swapRB(pixels, pixels, size);
+    return writePng(path, pixels, recording->width, recording->height, recording->width * sizeof(unsigned int));
+}
+
+static void recordingMain(void *data)
+{
+    Recording *recording = (Recording *)data;
+
+    mutexLock(recording->mutex);
+
+    for (;;)
+    {
+        while (recording->count == 0 && !recording->stopping)
+            condWait(recording->wake, recording->mutex);
+
+        if (recording->count == 0)
+            break;
+
+        int slot = recording->tail;
+        mutexUnlock(recording->mutex);
+
+        bool written = writeRecordedFrame(recording, slot);
+
+        mutexLock(recording->mutex);
+
+        if (written)
+            recording->written++;
+        else
+            recording->failed++;
+
+        recording->tail = (recording->tail + 1) % recording->slotCount;
+        recording->count--;
+    }
+
+    mutexUnlock(recording->mutex);
+}
+
+// Queues a copy of a presented frame, or counts it as dropped when the
+// writer is behind.
+static void recordFrame(Recording *recording, const unsigned int *pixels, int width, int height)
+{
+    unsigned long long number = recording->frames++;
+
+    if (recording->slots == NULL)
+    {
+        recording->slots = (unsigned int *)malloc((size_t)recording->slotCount * width * height * sizeof(unsigned int));
+        recording->numbers = (unsigned long long *)malloc(recording->slotCount * sizeof(unsigned long long));
+        recording->width = width;
+        recording->height = height;
+    }
+
+    mutexLock(recording->mutex);
+
+    bool full = recording->count == recording->slotCount;
+    if (full || recording->slots == NULL || recording->numbers == NULL || width != recording->width || height != recording->height)
+    {
+        recording->dropped++;
+        mutexUnlock(recording->mutex);
+        return;
+    }
+
+    // The writer only touches queued slots, so the free one after them can be
+    // filled without holding the lock.
+    int slot = (recording->tail + recording->count) % recording->slotCount;
+    mutexUnlock(recording->mutex);
+
+    int size = width * height;
+    raster.copy(recording->slots + (size_t)slot * size, pixels, size);
+    recording->numbers[slot] = number;
+
+    mutexLock(recording->mutex);
+    recording->count++;
+    condSignal(recording->wake);
+    mutexUnlock(recording->mutex);
+}
+
+// Lets the writer drain the queued frames and waits for it to finish. The
+// counters stay around for recordingStats.
+static void stopRecording(Recording *recording)
+{
+    if (recording->thread == NULL)
+        return;
+
+    mutexLock(recording->mutex);
+    recording->stopping = true;
+    condSignal(recording->wake);
+    mutexUnlock(recording->mutex);
+
+    threadJoin(recording->thread);
+    recording->thread = NULL;
+
+    if (recording->raw != NULL)
+        fclose(recording->raw);
+    recording->raw = NULL;
+
+    free(recording->slots);
+    free(recording->numbers);
+    recording->slots = NULL;
+    recording->numbers = NULL;
+}
+
+static void freeRecording(Recording *recording)
+{
+    if (recording == NULL)
+        return;
+
+    stopRecording(recording);
+
+    if (recording->raw != NULL)
+        fclose(recording->raw);
+
+    mutexDestroy(recording->mutex);
+    condDestroy(recording->wake);
+    free(recording);
+}
+
+void windowFinalize(void *data)
+{
+    Window *window = (Window *)data;
+
+    freeRecording(window->recording);
+    window->recording = NULL;
+
+    free(window->expanded);
+    window->expanded = NULL;
+}
+
 void windowCreate(WrenVM *vm)
 {
     Window *window = (Window *)wrenGetSlotForeign(vm, 0);
@@ -952,12 +5733,14 @@ void windowCreate2(WrenVM *vm)
     mfb_set_resize_callback(window->mfbWindow, resize);
 }
 
-void windowUpdate(WrenVM *vm)
+// Shows a frame and pumps the window events. source identifies the pixels
+// being shown; when the caller knows they are unchanged since source was last
+// shown and the window kept its size, only the events are pumped.
+static bool presentFrame(WrenVM *vm, Window *window, const void *source, unsigned int *pixels, int width, int height, bool unchanged)
 {
-    Window *window = (Window *)wrenGetSlotForeign(vm, 0);
-    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 1);
+    releaseDroppedHandles(vm);
 
-    mfb_set_user_data(window->mfbWindow, bitmap);
+    mfb_set_user_data(window->mfbWindow, window);
 
     const unsigned char *keyBuffer = mfb_get_key_buffer(window->mfbWindow);
     memcpy(prevKeyStates, keyBuffer, sizeof(prevKeyStates));
@@ -965,12 +5748,261 @@ void windowUpdate(WrenVM *vm)
     const unsigned char *buttonBuffer = mfb_get_mouse_button_buffer(window->mfbWindow);
     memcpy(prevButtonStates, buttonBuffer, sizeof(prevButtonStates));
 
-    mfb_update_state state = mfb_update_ex(window->mfbWindow, bitmap->buffer, bitmap->width, bitmap->height);
+    unsigned int windowWidth = mfb_get_window_width(window->mfbWindow);
+    unsigned int windowHeight = mfb_get_window_height(window->mfbWindow);
+    unchanged = unchanged && window->presented == source && window->presentedWidth == windowWidth && window->presentedHeight == windowHeight;
+
+    window->frameWidth = width;
+    window->frameHeight = height;
+
+    mfb_update_state state;
+    if (unchanged)
+        state = mfb_update_events(window->mfbWindow);
+    else
+        state = mfb_update_ex(window->mfbWindow, pixels, width, height);
+
     if (state != STATE_OK && state != STATE_EXIT)
     {
         wrenSetSlotString(vm, 0, "Error updating window");
         wrenAbortFiber(vm, 0);
+        return false;
+    }
+
+    window->presented = source;
+    window->presentedWidth = windowWidth;
+    window->presentedHeight = windowHeight;
+
+    if (window->recording != NULL && window->recording->thread != NULL)
+        recordFrame(window->recording, pixels, width, height);
+
+    return true;
+}
+
+// Returns a buffer owned by the window with room for size pixels, for frames
+// that have to be converted before they are shown.
+static unsigned int *windowScratch(WrenVM *vm, Window *window, int size)
+{
+    if (size > window->expandedSize)
+    {
+        unsigned int *expanded = (unsigned int *)realloc(window->expanded, size * sizeof(unsigned int));
+        if (expanded == NULL)
+        {
+            wrenSetSlotString(vm, 0, "Error allocating buffer");
+            wrenAbortFiber(vm, 0);
+            return NULL;
+        }
+
+        window->expanded = expanded;
+        window->expandedSize = size;
+        window->presented = NULL;
+    }
+
+    return window->expanded;
+}
+
+void windowUpdate(WrenVM *vm)
+{
+    Window *window = (Window *)wrenGetSlotForeign(vm, 0);
+    Bitmap *bitmap = (Bitmap *)wrenGetSlotForeign(vm, 1);
+
+    // Only a tracked bitmap knows whether it changed since it was last shown.
+    // A view can't tell, since its parent may have been drawn to directly.
+    bool unchanged = bitmap->trackDirty && !bitmap->changed && bitmap->parent == NULL;
+
+    // The window wants packed rows, so a view narrower than its parent is
+    // copied out first.
+    unsigned int *pixels = bitmap->buffer;
+    if (bitmap->pitch != bitmap->width)
+    {
+        pixels = windowScratch(vm, window, bitmap->width * bitmap->height);
+        if (pixels == NULL)
+            return;
+
+        for (int y = 0; y < bitmap->height; y++)
+            raster.copy(pixels + y * bitmap->width, bitmap->buffer + y * bitmap->pitch, bitmap->width);
+    }
+
+    if (presentFrame(vm, window, bitmap->buffer, pixels, bitmap->width, bitmap->height, unchanged))
+        bitmap->changed = false;
+}
+
+// Expands an indexed bitmap through its palette into a buffer owned by the
+// window. That only happens when the bitmap or palette changed or a different
+// bitmap was shown last.
+void windowUpdateIndexed(WrenVM *vm)
+{
+    Window *window = (Window *)wrenGetSlotForeign(vm, 0);
+    IndexedBitmap *bitmap = (IndexedBitmap *)wrenGetSlotForeign(vm, 1);
+
+    int size = bitmap->width * bitmap->height;
+    if (windowScratch(vm, window, size) == NULL)
+        return;
+
+    bool unchanged = !bitmap->changed && window->presented == bitmap->buffer;
+    if (!unchanged)
+        raster.lookup(window->expanded, bitmap->buffer, size, bitmap->palette);
+
+    if (presentFrame(vm, window, bitmap->buffer, window->expanded, bitmap->width, bitmap->height, unchanged))
+        bitmap->changed = false;
+}
+
+static bool stringToRecordFormat(const char *str, RecordFormat *format)
+{
+    if (strcmp(str, "qoi") == 0)
+        *format = RECORD_QOI;
+    else if (strcmp(str, "png") == 0)
+        *format = RECORD_PNG;
+    else if (strcmp(str, "raw") == 0)
+        *format = RECORD_RAW;
+    else
+        return false;
+
+    return true;
+}
+
+// Starts writing every frame the window shows into dir, either as numbered
+// image files or appended to dir/frames.raw as packed BGRA frames. Numbers
+// count every presented frame, so gaps show where frames were dropped.
+void windowStartRecording(WrenVM *vm)
+{
+    Window *window = (Window *)wrenGetSlotForeign(vm, 0);
+    const char *dir = wrenGetSlotString(vm, 1);
+    const char *formatName = wrenGetSlotString(vm, 2);
+    int buffers = (int)wrenGetSlotDouble(vm, 3);
+
+    RecordFormat format;
+    if (!stringToRecordFormat(formatName, &format))
+    {
+        wrenSetSlotString(vm, 0, "Invalid recording format");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    if (buffers < 1)
+    {
+        wrenSetSlotString(vm, 0, "Invalid recording buffer count");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    if (window->recording != NULL && window->recording->thread != NULL)
+    {
+        wrenSetSlotString(vm, 0, "Window is already recording");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    char fullPath[MAX_PATH_SIZE];
+    snprintf(fullPath, MAX_PATH_SIZE, "%s/%s", basePath, dir);
+
+    struct stat info;
+    if (stat(fullPath, &info) != 0)
+    {
+        wrenSetSlotString(vm, 0, "Error opening recording directory");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    freeRecording(window->recording);
+    window->recording = NULL;
+
+    Recording *recording = (Recording *)calloc(1, sizeof(Recording));
+    if (recording == NULL)
+    {
+        wrenSetSlotString(vm, 0, "Error allocating buffer");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    snprintf(recording->dir, MAX_PATH_SIZE, "%s", fullPath);
+    recording->format = format;
+    recording->slotCount = buffers;
+    recording->mutex = mutexCreate();
+    recording->wake = condCreate();
+
+    if (format == RECORD_RAW)
+    {
+        char rawPath[MAX_PATH_SIZE];
+        snprintf(rawPath, MAX_PATH_SIZE, "%s/frames.raw", fullPath);
+        recording->raw = fopen(rawPath, "wb");
+    }
+
+    if (recording->mutex == NULL || recording->wake == NULL || (format == RECORD_RAW && recording->raw == NULL) || (format == RECORD_PNG && !startImageJobs()))
+    {
+        freeRecording(recording);
+        wrenSetSlotString(vm, 0, "Error starting recording");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    recording->thread = threadCreate(recordingMain, recording);
+    if (recording->thread == NULL)
+    {
+        freeRecording(recording);
+        wrenSetSlotString(vm, 0, "Error starting recording");
+        wrenAbortFiber(vm, 0);
+        return;
+    }
+
+    window->recording = recording;
+}
+
+void windowStopRecording(WrenVM *vm)
+{
+    Window *window = (Window *)wrenGetSlotForeign(vm, 0);
+
+    if (window->recording != NULL)
+        stopRecording(window->recording);
+}
+
+void windowRecording(WrenVM *vm)
+{
+    Window *window = (Window *)wrenGetSlotForeign(vm, 0);
+
+    wrenSetSlotBool(vm, 0, window->recording != NULL && window->recording->thread != NULL);
+}
+
+// Counts for the current or last recording: frames shown, frames written,
+// frames dropped because the writer was behind or the size changed, and
+// frames that failed to write.
+void windowRecordingStats(WrenVM *vm)
+{
+    Window *window = (Window *)wrenGetSlotForeign(vm, 0);
+    Recording *recording = window->recording;
+
+    unsigned long long frames = 0;
+    unsigned long long written = 0;
+    unsigned long long dropped = 0;
+    unsigned long long failed = 0;
+
+    if (recording != NULL)
+    {
+        mutexLock(recording->mutex);
+        frames = recording->frames;
+        written = recording->written;
+        dropped = recording->dropped;
+        failed = recording->failed;
+        mutexUnlock(recording->mutex);
     }
+
+    wrenEnsureSlots(vm, 3);
+    wrenSetSlotNewMap(vm, 0);
+
+    wrenSetSlotString(vm, 1, "frames");
+    wrenSetSlotDouble(vm, 2, (double)frames);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "written");
+    wrenSetSlotDouble(vm, 2, (double)written);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "dropped");
+    wrenSetSlotDouble(vm, 2, (double)dropped);
+    wrenSetMapValue(vm, 0, 1, 2);
+
+    wrenSetSlotString(vm, 1, "failed");
+    wrenSetSlotDouble(vm, 2, (double)failed);
+    wrenSetMapValue(vm, 0, 1, 2);
 }
 
 void windowClose(WrenVM *vm)
@@ -3,31 +3,250 @@
 
 #include "lib/wren.h"
 
+#include "thread.h"
 #include "util.h"
 
+#include <stdio.h>
+
 static const char *wrenApi =
     "foreign class Bitmap {\n"
     "    foreign construct create(width, height)\n"
     "    foreign construct create(path)\n"
+    "    foreign construct view_(parent, x, y, width, height)\n"
+    "    foreign static poolStats\n"
+    "    foreign static trimPool()\n"
+    "    foreign static cacheStats\n"
+    "    foreign static cacheBudget\n"
+    "    foreign static cacheBudget=(value)\n"
+    "    foreign static pngCompression\n"
+    "    foreign static pngCompression=(value)\n"
+    "    static load(path) { BitmapLoad.create(path) }\n"
+    "    static loadAll(paths) { paths.map { |path| BitmapLoad.create(path) }.toList }\n"
     "    foreign destroy()\n"
     "    foreign save(path)\n"
+    "    saveAsync(path) { BitmapSave.create(this, path) }\n"
+    "    view(x, y, width, height) { Bitmap.view_(this, x, y, width, height) }\n"
     "    foreign width\n"
     "    foreign height\n"
     "    foreign get(x, y, pixel)\n"
+    "    foreign get(x, y)\n"
     "    foreign set(x, y, pixel)\n"
+    "    foreign getRow(y)\n"
+    "    foreign setRow(y, bytes)\n"
+    "    foreign getRect(x, y, width, height)\n"
+    "    foreign setRect(x, y, width, height, bytes)\n"
+    "    foreign copyFrom(bytes, format)\n"
     "    foreign clear()\n"
     "    foreign clear(pixel)\n"
+    "    foreign trackDirty\n"
+    "    foreign trackDirty=(value)\n"
+    "    foreign dirty\n"
+    "    foreign invalidate()\n"
     "    foreign rectangle(x, y, width, height, pixel)\n"
+    "    foreign line(x1, y1, x2, y2, pixel)\n"
+    "    foreign circle(x, y, radius, pixel)\n"
+    "    foreign fillCircle(x, y, radius, pixel)\n"
+    "    foreign fillTriangle(x1, y1, x2, y2, x3, y3, pixel)\n"
+    "    foreign fillPolygon(points, pixel)\n"
     "    foreign blit(bitmap, x, y)\n"
     "    foreign blit(bitmap, x, y, pixel)\n"
     "    foreign blitRec(bitmap, x, y, srcX, srcY, width, height)\n"
     "    foreign blitRec(bitmap, x, y, srcX, srcY, width, height, pixel)\n"
+    "    foreign blitScaled(bitmap, x, y, width, height)\n"
+    "    foreign blitScaled(bitmap, x, y, width, height, filter)\n"
+    "    foreign blitScaled(bitmap, x, y, width, height, filter, pixel)\n"
+    "    foreign blitFlipped(bitmap, x, y, flipX, flipY)\n"
+    "    foreign blitFlipped(bitmap, x, y, flipX, flipY, pixel)\n"
+    "    foreign blitTransformed(bitmap, x, y, angle, scaleX, scaleY)\n"
+    "    foreign blitTransformed(bitmap, x, y, angle, scaleX, scaleY, filter)\n"
+    "    foreign blitTransformed(bitmap, x, y, angle, scaleX, scaleY, filter, pixel)\n"
+    "    foreign resizeInto(bitmap)\n"
+    "    foreign resizeInto(bitmap, filter)\n"
+    "    resized(width, height) { resized(width, height, \"default\") }\n"
+    "    resized(width, height, filter) {\n"
+    "        var bitmap = Bitmap.create(width, height)\n"
+    "        resizeInto(bitmap, filter)\n"
+    "        return bitmap\n"
+    "    }\n"
+    "    mipmaps() {\n"
+    "        var levels = [this]\n"
+    "        var level = this\n"
+    "        while (level.width > 1 || level.height > 1) {\n"
+    "            level = level.resized((level.width / 2).floor.max(1), (level.height / 2).floor.max(1), \"box\")\n"
+    "            levels.add(level)\n"
+    "        }\n"
+    "        return levels\n"
+    "    }\n"
+    "    foreign blur(radius)\n"
+    "    foreign boxBlur(radius)\n"
+    "    foreign convolve(kernel)\n"
+    "    foreign colorMatrix(matrix)\n"
+    "    foreign blend(bitmap, x, y, mode)\n"
+    "    foreign blend(bitmap, x, y, mode, opacity)\n"
+    "    foreign blendRec(bitmap, x, y, srcX, srcY, width, height, mode)\n"
+    "    foreign blendRec(bitmap, x, y, srcX, srcY, width, height, mode, opacity)\n"
     "    foreign text(x, y, text, font)\n"
+    "    foreign text(x, y, text, font, color)\n"
+    "    foreign text(x, y, layout)\n"
+    "    foreign draw(list)\n"
+    "}\n"
+    "\n"
+    "foreign class BitmapLoad {\n"
+    "    foreign construct create(path)\n"
+    "    foreign path\n"
+    "    foreign done\n"
+    "    foreign error\n"
+    "    foreign bitmap\n"
+    "    wait() { bitmap }\n"
+    "\n"
+    "    await() {\n"
+    "        while (!done) Fiber.yield()\n"
+    "        return bitmap\n"
+    "    }\n"
+    "\n"
+    "    static waitAll(loads) { loads.map { |load| load.bitmap }.toList }\n"
+    "    static progress(loads) { loads.count == 0 ? 1 : loads.count { |load| load.done } / loads.count }\n"
+    "}\n"
+    "\n"
+    "foreign class BitmapSave {\n"
+    "    foreign construct create(bitmap, path)\n"
+    "    foreign path\n"
+    "    foreign done\n"
+    "    foreign error\n"
+    "    foreign wait()\n"
     "}\n"
     "\n"
     "foreign class Font {\n"
     "    foreign construct create(path, glyphWidth, glyphHeight)\n"
+    "    foreign construct truetype(path, pixelSize)\n"
+    "    foreign static glyphCacheStats\n"
+    "    foreign static renderCacheStats\n"
+    "    foreign static renderCacheBudget\n"
+    "    foreign static renderCacheBudget=(value)\n"
     "    foreign destroy()\n"
+    "    foreign measure(text)\n"
+    "    foreign wrap(text, width)\n"
+    "    foreign render(text, color)\n"
+    "    layout(text) { TextLayout.create(this, text, 0) }\n"
+    "    layout(text, width) { TextLayout.create(this, text, width) }\n"
+    "}\n"
+    "\n"
+    "foreign class TextLayout {\n"
+    "    foreign construct create(font, text, width)\n"
+    "    foreign width\n"
+    "    foreign height\n"
+    "    foreign runCount\n"
+    "    foreign run(index)\n"
+    "    foreign glyphCount\n"
+    "    foreign glyph(index)\n"
+    "}\n"
+    "\n"
+    "foreign class DrawList {\n"
+    "    foreign construct create()\n"
+    "    foreign reset()\n"
+    "    foreign count\n"
+    "    foreign sorted\n"
+    "    foreign sorted=(value)\n"
+    "    foreign tiled\n"
+    "    foreign tiled=(value)\n"
+    "    foreign clear(pixel)\n"
+    "    foreign rectangle(x, y, width, height, pixel)\n"
+    "    foreign blit(bitmap, x, y)\n"
+    "    foreign blit(bitmap, x, y, pixel)\n"
+    "    foreign blitRec(bitmap, x, y, srcX, srcY, width, height)\n"
+    "    foreign blitRec(bitmap, x, y, srcX, srcY, width, height, pixel)\n"
+    "    foreign text(x, y, text, font)\n"
+    "}\n"
+    "\n"
+    "foreign class IndexedBitmap {\n"
+    "    foreign construct create(width, height)\n"
+    "    foreign destroy()\n"
+    "    foreign width\n"
+    "    foreign height\n"
+    "    foreign get(x, y)\n"
+    "    foreign set(x, y, index)\n"
+    "    foreign clear(index)\n"
+    "    foreign rectangle(x, y, width, height, index)\n"
+    "    foreign blit(bitmap, x, y)\n"
+    "    foreign blit(bitmap, x, y, key)\n"
+    "    foreign blitRec(bitmap, x, y, srcX, srcY, width, height)\n"
+    "    foreign blitRec(bitmap, x, y, srcX, srcY, width, height, key)\n"
+    "    foreign palette(index)\n"
+    "    foreign setPalette(index, color)\n"
+    "    foreign rotatePalette(first, count, shift)\n"
+    "    foreign copyFrom(bytes)\n"
+    "    foreign expand(bitmap)\n"
+    "}\n"
+    "\n"
+    "foreign class Packer {\n"
+    "    foreign construct create(width, height)\n"
+    "    foreign width\n"
+    "    foreign height\n"
+    "    foreign insert(width, height)\n"
+    "    foreign reset()\n"
+    "}\n"
+    "\n"
+    "class AtlasRegion {\n"
+    "    construct new_(page, x, y, width, height) {\n"
+    "        _page = page\n"
+    "        _x = x\n"
+    "        _y = y\n"
+    "        _width = width\n"
+    "        _height = height\n"
+    "    }\n"
+    "\n"
+    "    page { _page }\n"
+    "    x { _x }\n"
+    "    y { _y }\n"
+    "    width { _width }\n"
+    "    height { _height }\n"
+    "\n"
+    "    blit(bitmap, x, y) { _page.blitRec(bitmap, x, y, _x, _y, _width, _height) }\n"
+    "    blit(bitmap, x, y, pixel) { _page.blitRec(bitmap, x, y, _x, _y, _width, _height, pixel) }\n"
+    "}\n"
+    "\n"
+    "class Atlas {\n"
+    "    construct create(width, height) {\n"
+    "        _width = width\n"
+    "        _height = height\n"
+    "        _pages = []\n"
+    "        _packers = []\n"
+    "    }\n"
+    "\n"
+    "    width { _width }\n"
+    "    height { _height }\n"
+    "    pages { _pages }\n"
+    "\n"
+    "    add(image) { image is String ? addPath_(image) : addBitmap_(image) }\n"
+    "\n"
+    "    addPath_(path) {\n"
+    "        var bitmap = Bitmap.create(path)\n"
+    "        var region = addBitmap_(bitmap)\n"
+    "        bitmap.destroy()\n"
+    "        return region\n"
+    "    }\n"
+    "\n"
+    "    addBitmap_(bitmap) {\n"
+    "        for (i in 0..._packers.count) {\n"
+    "            var spot = _packers[i].insert(bitmap.width, bitmap.height)\n"
+    "            if (spot != null) return place_(_pages[i], spot, bitmap)\n"
+    "        }\n"
+    "\n"
+    "        var packer = Packer.create(_width, _height)\n"
+    "        var spot = packer.insert(bitmap.width, bitmap.height)\n"
+    "        if (spot == null) Fiber.abort(\"Image is larger than an atlas page\")\n"
+    "\n"
+    "        var page = Bitmap.create(_width, _height)\n"
+    "        page.clear()\n"
+    "        _pages.add(page)\n"
+    "        _packers.add(packer)\n"
+    "        return place_(page, spot, bitmap)\n"
+    "    }\n"
+    "\n"
+    "    place_(page, spot, bitmap) {\n"
+    "        bitmap.blit(page, spot[0], spot[1])\n"
+    "        return AtlasRegion.new_(page, spot[0], spot[1], bitmap.width, bitmap.height)\n"
+    "    }\n"
     "}\n"
     "\n"
     "class OS {\n"
@@ -35,6 +254,7 @@ static const char *wrenApi =
     "    foreign static basilVersion\n"
     "    foreign static args\n"
     "    foreign static readLine()\n"
+    "    foreign static simd\n"
     "}\n"
     "\n"
     "foreign class Pixel {\n"
@@ -47,6 +267,18 @@ static const char *wrenApi =
     "    foreign toString\n"
     "}\n"
     "\n"
+    "class Color {\n"
+    "    static rgb(r, g, b) { rgba(r, g, b, 255) }\n"
+    "    static rgba(r, g, b, a) { (a << 24) | (r << 16) | (g << 8) | b }\n"
+    "    static r(color) { (color >> 16) & 0xFF }\n"
+    "    static g(color) { (color >> 8) & 0xFF }\n"
+    "    static b(color) { color & 0xFF }\n"
+    "    static a(color) { (color >> 24) & 0xFF }\n"
+    "    static black { 0xFF000000 }\n"
+    "    static white { 0xFFFFFFFF }\n"
+    "    static transparent { 0x00000000 }\n"
+    "}\n"
+    "\n"
     "foreign class Timer {\n"
     "    foreign construct create()\n"
     "    foreign destroy()\n"
@@ -58,7 +290,9 @@ static const char *wrenApi =
     "foreign class Window {\n"
     "    foreign construct create(width, height, title, resizable)\n"
     "    foreign construct create(width, height, title)\n"
-    "    foreign update(bitmap)\n"
+    "    update(bitmap) { bitmap is IndexedBitmap ? updateIndexed_(bitmap) : update_(bitmap) }\n"
+    "    foreign update_(bitmap)\n"
+    "    foreign updateIndexed_(bitmap)\n"
     "    foreign close()\n"
     "    foreign keyDown(key)\n"
     "    foreign keyPressed(key)\n"
@@ -76,54 +310,450 @@ static const char *wrenApi =
     "    foreign scrollY\n"
     "    foreign targetFps\n"
     "    foreign targetFps=(value)\n"
+    "    startRecording(dir) { startRecording(dir, {}) }\n"
+    "    startRecording(dir, options) { startRecording_(dir, options[\"format\"] || \"qoi\", options[\"buffers\"] || 8) }\n"
+    "    foreign startRecording_(dir, format, buffers)\n"
+    "    foreign stopRecording()\n"
+    "    foreign recording\n"
+    "    foreign recordingStats\n"
     "}\n";
 
 extern char basePath[MAX_PATH_SIZE];
 
 void setArgs(int argc, char **argv);
+void waitForSaves(void);
+
+// A handle a foreign object keeps on another object to hold it alive. Wren
+// can't be called from a finalizer, so finalizers only drop their handles,
+// which are released the next time a handle is taken or a frame is shown.
+// Before the VM is freed every handle still held is released as well.
+typedef struct HeldHandle
+{
+    WrenVM *vm;
+    WrenHandle *handle;
+    struct HeldHandle *prev;
+    struct HeldHandle *next;
+} HeldHandle;
 
+void releaseDroppedHandles(WrenVM *vm);
+void releaseHeldHandles(WrenVM *vm);
+
+// Decoded image shared by every Bitmap and Font loaded from the same file, or
+// text rendered by Font.render, which has text set and is kept in a cache of
+// its own keyed by font, text and color and found through a hash table, with
+// chain linking the entries in a slot. Entries nobody holds stay cached
+// until their cache outgrows its budget; an entry whose file changed on disk
+// or whose font was released is marked stale and freed on its last release.
+typedef struct CachedImage
+{
+    char path[MAX_PATH_SIZE];
+    long long mtime;
+    struct Font *font;
+    char *text;
+    unsigned int color;
+    unsigned int hash;
+    struct CachedImage *chain;
+    unsigned int *pixels;
+    int width;
+    int height;
+    int refs;
+    bool stale;
+    unsigned long long lastUse;
+    struct CachedImage *next;
+} CachedImage;
+
+#define MAX_DIRTY_RECTS 16
+
+typedef struct DirtyRect
+{
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+} DirtyRect;
+
+// With trackDirty set, every draw records the rectangle it touched. A clear
+// with the same color as the previous one then only refills those rects, and
+// changed tells Window.update whether anything was drawn since the bitmap was
+// last shown.
+//
+// Rows are pitch pixels apart. A view aliases a rectangle of its parent's
+// buffer, holds a handle that keeps the parent alive and passes its dirty
+// rects on to the parent; views counts the live views of a bitmap. A bitmap
+// loaded from a file reads from shared cached pixels until it is first drawn
+// to, when it gets a copy of its own.
 typedef struct Bitmap
 {
     int width;
     int height;
+    int pitch;
     unsigned int *buffer;
+    CachedImage *shared;
+    struct Bitmap *parent;
+    HeldHandle *parentHandle;
+    int parentX;
+    int parentY;
+    int views;
+    bool trackDirty;
+    bool changed;
+    bool cleared;
+    unsigned int clearColor;
+    int dirtyCount;
+    DirtyRect dirty[MAX_DIRTY_RECTS];
 } Bitmap;
 
 void bitmapAllocate(WrenVM *vm);
 void bitmapFinalize(void *data);
 void bitmapCreate(WrenVM *vm);
 void bitmapCreate2(WrenVM *vm);
+void bitmapView(WrenVM *vm);
 void bitmapDestroy(WrenVM *vm);
+void bitmapPoolStats(WrenVM *vm);
+void bitmapTrimPool(WrenVM *vm);
+void bitmapCacheStats(WrenVM *vm);
+void bitmapCacheBudget(WrenVM *vm);
+void bitmapCacheBudgetSet(WrenVM *vm);
+void bitmapPngCompression(WrenVM *vm);
+void bitmapPngCompressionSet(WrenVM *vm);
 void bitmapSave(WrenVM *vm);
 void bitmapWidth(WrenVM *vm);
 void bitmapHeight(WrenVM *vm);
 void bitmapGet(WrenVM *vm);
+void bitmapGet2(WrenVM *vm);
 void bitmapSet(WrenVM *vm);
+void bitmapGetRow(WrenVM *vm);
+void bitmapSetRow(WrenVM *vm);
+void bitmapGetRect(WrenVM *vm);
+void bitmapSetRect(WrenVM *vm);
+void bitmapCopyFrom(WrenVM *vm);
 void bitmapClear(WrenVM *vm);
 void bitmapClear2(WrenVM *vm);
+void bitmapTrackDirty(WrenVM *vm);
+void bitmapTrackDirtySet(WrenVM *vm);
+void bitmapDirty(WrenVM *vm);
+void bitmapInvalidate(WrenVM *vm);
 void bitmapRectangle(WrenVM *vm);
+void bitmapLine(WrenVM *vm);
+void bitmapCircle(WrenVM *vm);
+void bitmapFillCircle(WrenVM *vm);
+void bitmapFillTriangle(WrenVM *vm);
+void bitmapFillPolygon(WrenVM *vm);
 void bitmapBlit(WrenVM *vm);
 void bitmapBlit2(WrenVM *vm);
 void bitmapBlitRec(WrenVM *vm);
 void bitmapBlitRec2(WrenVM *vm);
+void bitmapBlitScaled(WrenVM *vm);
+void bitmapBlitScaled2(WrenVM *vm);
+void bitmapBlitScaled3(WrenVM *vm);
+void bitmapBlitFlipped(WrenVM *vm);
+void bitmapBlitFlipped2(WrenVM *vm);
+void bitmapBlitTransformed(WrenVM *vm);
+void bitmapBlitTransformed2(WrenVM *vm);
+void bitmapBlitTransformed3(WrenVM *vm);
+void bitmapResizeInto(WrenVM *vm);
+void bitmapResizeInto2(WrenVM *vm);
+void bitmapBlur(WrenVM *vm);
+void bitmapBoxBlur(WrenVM *vm);
+void bitmapConvolve(WrenVM *vm);
+void bitmapColorMatrix(WrenVM *vm);
+void bitmapBlend(WrenVM *vm);
+void bitmapBlend2(WrenVM *vm);
+void bitmapBlendRec(WrenVM *vm);
+void bitmapBlendRec2(WrenVM *vm);
 void bitmapText(WrenVM *vm);
+void bitmapText2(WrenVM *vm);
+void bitmapText3(WrenVM *vm);
+void bitmapDraw(WrenVM *vm);
+
+// Decode state shared with the worker that runs it. It lives apart from the
+// BitmapLoad so the worker can finish after the handle was collected; whichever
+// side lets go last frees it.
+typedef struct ImageJob
+{
+    char path[MAX_PATH_SIZE];
+    unsigned int *buffer;
+    int width;
+    int height;
+    bool done;
+    bool abandoned;
+} ImageJob;
+
+typedef struct BitmapLoad
+{
+    ImageJob *job;
+    char path[MAX_PATH_SIZE];
+    HeldHandle *bitmap;
+} BitmapLoad;
+
+void bitmapLoadAllocate(WrenVM *vm);
+void bitmapLoadFinalize(void *data);
+void bitmapLoadCreate(WrenVM *vm);
+void bitmapLoadPath(WrenVM *vm);
+void bitmapLoadDone(WrenVM *vm);
+void bitmapLoadError(WrenVM *vm);
+void bitmapLoadBitmap(WrenVM *vm);
+
+typedef enum
+{
+    IMAGE_PNG,
+    IMAGE_BMP,
+    IMAGE_TGA,
+    IMAGE_QOI
+} ImageFormat;
+
+// Encode state for Bitmap.saveAsync, owned like ImageJob. pixels is a packed
+// snapshot taken when the save was started.
+typedef struct SaveJob
+{
+    char path[MAX_PATH_SIZE];
+    ImageFormat format;
+    unsigned int *pixels;
+    int width;
+    int height;
+    bool done;
+    bool failed;
+    bool abandoned;
+} SaveJob;
+
+typedef struct BitmapSave
+{
+    SaveJob *job;
+    char path[MAX_PATH_SIZE];
+} BitmapSave;
+
+void bitmapSaveAllocate(WrenVM *vm);
+void bitmapSaveFinalize(void *data);
+void bitmapSaveCreate(WrenVM *vm);
+void bitmapSavePath(WrenVM *vm);
+void bitmapSaveDone(WrenVM *vm);
+void bitmapSaveError(WrenVM *vm);
+void bitmapSaveWait(WrenVM *vm);
+
+// TrueType file shared by every Font.truetype made from it, at any size.
+typedef struct TrueTypeFace TrueTypeFace;
+
+// A glyph of a TrueType face rasterized at one pixel size. Its coverage is
+// the width x height rect at (x, y) in the glyph atlas, to be drawn offsetX
+// and offsetY away from the pen on the baseline. face is 0 for a free slot.
+typedef struct CachedGlyph
+{
+    unsigned int face;
+    int size;
+    unsigned int codepoint;
+    int index;
+    int x;
+    int y;
+    int width;
+    int height;
+    int offsetX;
+    int offsetY;
+    float advance;
+} CachedGlyph;
+
+// Run of pixels in row y of a sheet glyph that aren't the transparent key.
+typedef struct GlyphSpan
+{
+    int x;
+    int y;
+    int length;
+} GlyphSpan;
+
+// Cell of a glyph sheet character and its spans in Font.spans.
+typedef struct SheetGlyph
+{
+    int srcX;
+    int srcY;
+    int spanStart;
+    int spanCount;
+} SheetGlyph;
+
+// Glyph placed by a layout: x is the pen position from the left edge, which
+// TrueType glyphs round when drawn, and y the top of its line.
+typedef struct LayoutGlyph
+{
+    float x;
+    int y;
+    unsigned int codepoint;
+} LayoutGlyph;
+
+// Line of a layout, with its glyphs and the bytes of text it covers.
+typedef struct LayoutRun
+{
+    int glyphStart;
+    int glyphCount;
+    int textStart;
+    int textLength;
+    int y;
+    int width;
+} LayoutRun;
+
+// Text broken into runs of placed glyphs, one per line, wrapped to wrapWidth
+// when it's above zero. Fonts cache layouts by the hash of the text and wrap
+// width; refs counts the cache and the TextLayout objects holding one.
+typedef struct Layout
+{
+    char *text;
+    unsigned int hash;
+    int wrapWidth;
+    int width;
+    int height;
+    LayoutGlyph *glyphs;
+    int glyphCount;
+    LayoutRun *runs;
+    int runCount;
+    int refs;
+} Layout;
 
+// A glyph sheet cut into glyphWidth x glyphHeight cells, or a TrueType face at
+// pixelSize when face is set. For TrueType fonts glyphHeight is the line
+// height and glyphWidth the advance of a space. Sheet fonts keep a table of
+// glyphs for characters 32 to 255, built when the sheet is loaded.
 typedef struct Font
 {
     int glyphWidth;
     int glyphHeight;
     Bitmap bitmap;
+    SheetGlyph *glyphs;
+    GlyphSpan *spans;
+    TrueTypeFace *face;
+    int pixelSize;
+    float scale;
+    int ascent;
+    Layout **layouts;
 } Font;
 
 void fontAllocate(WrenVM *vm);
 void fontFinalize(void *data);
 void fontCreate(WrenVM *vm);
+void fontTrueType(WrenVM *vm);
+void fontGlyphCacheStats(WrenVM *vm);
 void fontDestroy(WrenVM *vm);
+void fontMeasure(WrenVM *vm);
+void fontWrap(WrenVM *vm);
+void fontRender(WrenVM *vm);
+void fontRenderCacheStats(WrenVM *vm);
+void fontRenderCacheBudget(WrenVM *vm);
+void fontRenderCacheBudgetSet(WrenVM *vm);
+
+// A layout held by a script, with a handle that keeps its font alive.
+typedef struct TextLayout
+{
+    Layout *layout;
+    Font *font;
+    HeldHandle *fontHandle;
+} TextLayout;
+
+void textLayoutAllocate(WrenVM *vm);
+void textLayoutFinalize(void *data);
+void textLayoutCreate(WrenVM *vm);
+void textLayoutWidth(WrenVM *vm);
+void textLayoutHeight(WrenVM *vm);
+void textLayoutRunCount(WrenVM *vm);
+void textLayoutRun(WrenVM *vm);
+void textLayoutGlyphCount(WrenVM *vm);
+void textLayoutGlyph(WrenVM *vm);
+
+typedef enum
+{
+    DRAW_CLEAR,
+    DRAW_RECTANGLE,
+    DRAW_BLIT,
+    DRAW_BLIT_KEYED,
+    DRAW_GLYPH
+} DrawType;
+
+typedef struct DrawCommand
+{
+    Bitmap *bitmap;
+    Font *font;
+    const SheetGlyph *glyph;
+    int x;
+    int y;
+    int srcX;
+    int srcY;
+    int width;
+    int height;
+    unsigned int color;
+    unsigned int order;
+    DrawType type;
+} DrawCommand;
+
+typedef struct DrawList
+{
+    DrawCommand *commands;
+    int count;
+    int capacity;
+    bool sorted;
+    bool tiled;
+    bool needsSort;
+    void **sources;
+    HeldHandle **handles;
+    int sourceCount;
+    int sourceCapacity;
+} DrawList;
+
+void drawListAllocate(WrenVM *vm);
+void drawListFinalize(void *data);
+void drawListCreate(WrenVM *vm);
+void drawListReset(WrenVM *vm);
+void drawListCount(WrenVM *vm);
+void drawListSorted(WrenVM *vm);
+void drawListSortedSet(WrenVM *vm);
+void drawListTiled(WrenVM *vm);
+void drawListTiledSet(WrenVM *vm);
+void drawListClear(WrenVM *vm);
+void drawListRectangle(WrenVM *vm);
+void drawListBlit(WrenVM *vm);
+void drawListBlit2(WrenVM *vm);
+void drawListBlitRec(WrenVM *vm);
+void drawListBlitRec2(WrenVM *vm);
+void drawListText(WrenVM *vm);
+
+// 8-bit bitmap whose pixels index a 256-entry ARGB palette. It is expanded to
+// ARGB only when shown, so blits move a quarter of the bytes and changing
+// the palette recolors the whole image for free.
+typedef struct IndexedBitmap
+{
+    int width;
+    int height;
+    unsigned char *buffer;
+    unsigned int palette[256];
+    bool changed;
+} IndexedBitmap;
+
+void indexedBitmapAllocate(WrenVM *vm);
+void indexedBitmapFinalize(void *data);
+void indexedBitmapCreate(WrenVM *vm);
+void indexedBitmapDestroy(WrenVM *vm);
+void indexedBitmapWidth(WrenVM *vm);
+void indexedBitmapHeight(WrenVM *vm);
+void indexedBitmapGet(WrenVM *vm);
+void indexedBitmapSet(WrenVM *vm);
+void indexedBitmapClear(WrenVM *vm);
+void indexedBitmapRectangle(WrenVM *vm);
+void indexedBitmapBlit(WrenVM *vm);
+void indexedBitmapBlit2(WrenVM *vm);
+void indexedBitmapBlitRec(WrenVM *vm);
+void indexedBitmapBlitRec2(WrenVM *vm);
+void indexedBitmapPalette(WrenVM *vm);
+void indexedBitmapSetPalette(WrenVM *vm);
+void indexedBitmapRotatePalette(WrenVM *vm);
+void indexedBitmapCopyFrom(WrenVM *vm);
+void indexedBitmapExpand(WrenVM *vm);
+
+void packerAllocate(WrenVM *vm);
+void packerFinalize(void *data);
+void packerCreate(WrenVM *vm);
+void packerWidth(WrenVM *vm);
+void packerHeight(WrenVM *vm);
+void packerInsert(WrenVM *vm);
+void packerReset(WrenVM *vm);
 
 void osName(WrenVM *vm);
 void osBasilVersion(WrenVM *vm);
 void osArgs(WrenVM *vm);
 void osReadLine(WrenVM *vm);
+void osSimd(WrenVM *vm);
 
 typedef struct Pixel
 {
@@ -155,15 +785,59 @@ void timerReset(WrenVM *vm);
 void timerNow(WrenVM *vm);
 void timerDelta(WrenVM *vm);
 
+typedef enum
+{
+    RECORD_QOI,
+    RECORD_PNG,
+    RECORD_RAW
+} RecordFormat;
+
+// Frames shown while recording are copied into a ring of slotCount slots and
+// written out by a thread of its own. The script thread fills the slot after
+// the last queued one and never waits: with every slot queued the frame is
+// dropped. Slots are allocated for the size of the first frame, and frames of
+// another size are dropped as well.
+typedef struct Recording
+{
+    char dir[MAX_PATH_SIZE];
+    RecordFormat format;
+    FILE *raw;
+    Thread *thread;
+    Mutex *mutex;
+    Cond *wake;
+    unsigned int *slots;
+    unsigned long long *numbers;
+    int slotCount;
+    int width;
+    int height;
+    int tail;
+    int count;
+    bool stopping;
+    unsigned long long frames;
+    unsigned long long written;
+    unsigned long long dropped;
+    unsigned long long failed;
+} Recording;
+
 typedef struct Window
 {
     struct mfb_window *mfbWindow;
+    const void *presented;
+    unsigned int presentedWidth;
+    unsigned int presentedHeight;
+    int frameWidth;
+    int frameHeight;
+    unsigned int *expanded;
+    int expandedSize;
+    Recording *recording;
 } Window;
 
 void windowAllocate(WrenVM *vm);
+void windowFinalize(void *data);
 void windowCreate(WrenVM *vm);
 void windowCreate2(WrenVM *vm);
 void windowUpdate(WrenVM *vm);
+void windowUpdateIndexed(WrenVM *vm);
 void windowClose(WrenVM *vm);
 void windowKeyDown(WrenVM *vm);
 void windowKeyPressed(WrenVM *vm);
@@ -181,5 +855,9 @@ void windowScrollX(WrenVM *vm);
 void windowScrollY(WrenVM *vm);
 void windowTargetFps(WrenVM *vm);
 void windowTargetFpsSet(WrenVM *vm);
+void windowStartRecording(WrenVM *vm);
+void windowStopRecording(WrenVM *vm);
+void windowRecording(WrenVM *vm);
+void windowRecordingStats(WrenVM *vm);
 
 #endif
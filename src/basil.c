@@ -13,6 +13,8 @@
 
 #include "api.h"
 #include "embed.h"
+#include "pool.h"
+#include "raster.h"
 #include "util.h"
 
 char basePath[MAX_PATH_SIZE];
@@ -92,11 +94,41 @@ static WrenForeignClassMethods wrenBindForeignClass(WrenVM *vm, const char *modu
         methods.allocate = bitmapAllocate;
         methods.finalize = bitmapFinalize;
     }
+    else if (strcmp(className, "BitmapLoad") == 0)
+    {
+        methods.allocate = bitmapLoadAllocate;
+        methods.finalize = bitmapLoadFinalize;
+    }
+    else if (strcmp(className, "BitmapSave") == 0)
+    {
+        methods.allocate = bitmapSaveAllocate;
+        methods.finalize = bitmapSaveFinalize;
+    }
     else if (strcmp(className, "Font") == 0)
     {
         methods.allocate = fontAllocate;
         methods.finalize = fontFinalize;
     }
+    else if (strcmp(className, "TextLayout") == 0)
+    {
+        methods.allocate = textLayoutAllocate;
+        methods.finalize = textLayoutFinalize;
+    }
+    else if (strcmp(className, "DrawList") == 0)
+    {
+        methods.allocate = drawListAllocate;
+        methods.finalize = drawListFinalize;
+    }
+    else if (strcmp(className, "IndexedBitmap") == 0)
+    {
+        methods.allocate = indexedBitmapAllocate;
+        methods.finalize = indexedBitmapFinalize;
+    }
+    else if (strcmp(className, "Packer") == 0)
+    {
+        methods.allocate = packerAllocate;
+        methods.finalize = packerFinalize;
+    }
     else if (strcmp(className, "Pixel") == 0)
     {
         methods.allocate = pixelAllocate;
@@ -109,6 +141,7 @@ static WrenForeignClassMethods wrenBindForeignClass(WrenVM *vm, const char *modu
     else if (strcmp(className, "Window") == 0)
     {
         methods.allocate = windowAllocate;
+        methods.finalize = windowFinalize;
     }
 
     return methods;
@@ -124,6 +157,8 @@ static WrenForeignMethodFn wrenBindForeignMethod(WrenVM *vm, const char *module,
                 return bitmapCreate;
             if (strcmp(signature, "init create(_)") == 0)
                 return bitmapCreate2;
+            if (strcmp(signature, "init view_(_,_,_,_,_)") == 0)
+                return bitmapView;
             if (strcmp(signature, "destroy()") == 0)
                 return bitmapDestroy;
             if (strcmp(signature, "save(_)") == 0)
@@ -134,14 +169,44 @@ static WrenForeignMethodFn wrenBindForeignMethod(WrenVM *vm, const char *module,
                 return bitmapHeight;
             if (strcmp(signature, "get(_,_,_)") == 0)
                 return bitmapGet;
+            if (strcmp(signature, "get(_,_)") == 0)
+                return bitmapGet2;
             if (strcmp(signature, "set(_,_,_)") == 0)
                 return bitmapSet;
+            if (strcmp(signature, "getRow(_)") == 0)
+                return bitmapGetRow;
+            if (strcmp(signature, "setRow(_,_)") == 0)
+                return bitmapSetRow;
+            if (strcmp(signature, "getRect(_,_,_,_)") == 0)
+                return bitmapGetRect;
+            if (strcmp(signature, "setRect(_,_,_,_,_)") == 0)
+                return bitmapSetRect;
+            if (strcmp(signature, "copyFrom(_,_)") == 0)
+                return bitmapCopyFrom;
             if (strcmp(signature, "clear()") == 0)
                 return bitmapClear;
             if (strcmp(signature, "clear(_)") == 0)
                 return bitmapClear2;
+            if (strcmp(signature, "trackDirty") == 0)
+                return bitmapTrackDirty;
+            if (strcmp(signature, "trackDirty=(_)") == 0)
+                return bitmapTrackDirtySet;
+            if (strcmp(signature, "dirty") == 0)
+                return bitmapDirty;
+            if (strcmp(signature, "invalidate()") == 0)
+                return bitmapInvalidate;
             if (strcmp(signature, "rectangle(_,_,_,_,_)") == 0)
                 return bitmapRectangle;
+            if (strcmp(signature, "line(_,_,_,_,_)") == 0)
+                return bitmapLine;
+            if (strcmp(signature, "circle(_,_,_,_)") == 0)
+                return bitmapCircle;
+            if (strcmp(signature, "fillCircle(_,_,_,_)") == 0)
+                return bitmapFillCircle;
+            if (strcmp(signature, "fillTriangle(_,_,_,_,_,_,_)") == 0)
+                return bitmapFillTriangle;
+            if (strcmp(signature, "fillPolygon(_,_)") == 0)
+                return bitmapFillPolygon;
             if (strcmp(signature, "blit(_,_,_)") == 0)
                 return bitmapBlit;
             if (strcmp(signature, "blit(_,_,_,_)") == 0)
@@ -150,15 +215,189 @@ static WrenForeignMethodFn wrenBindForeignMethod(WrenVM *vm, const char *module,
                 return bitmapBlitRec;
             if (strcmp(signature, "blitRec(_,_,_,_,_,_,_,_)") == 0)
                 return bitmapBlitRec2;
+            if (strcmp(signature, "blitScaled(_,_,_,_,_)") == 0)
+                return bitmapBlitScaled;
+            if (strcmp(signature, "blitScaled(_,_,_,_,_,_)") == 0)
+                return bitmapBlitScaled2;
+            if (strcmp(signature, "blitScaled(_,_,_,_,_,_,_)") == 0)
+                return bitmapBlitScaled3;
+            if (strcmp(signature, "blitFlipped(_,_,_,_,_)") == 0)
+                return bitmapBlitFlipped;
+            if (strcmp(signature, "blitFlipped(_,_,_,_,_,_)") == 0)
+                return bitmapBlitFlipped2;
+            if (strcmp(signature, "blitTransformed(_,_,_,_,_,_)") == 0)
+                return bitmapBlitTransformed;
+            if (strcmp(signature, "blitTransformed(_,_,_,_,_,_,_)") == 0)
+                return bitmapBlitTransformed2;
+            if (strcmp(signature, "blitTransformed(_,_,_,_,_,_,_,_)") == 0)
+                return bitmapBlitTransformed3;
+            if (strcmp(signature, "resizeInto(_)") == 0)
+                return bitmapResizeInto;
+            if (strcmp(signature, "resizeInto(_,_)") == 0)
+                return bitmapResizeInto2;
+            if (strcmp(signature, "blur(_)") == 0)
+                return bitmapBlur;
+            if (strcmp(signature, "boxBlur(_)") == 0)
+                return bitmapBoxBlur;
+            if (strcmp(signature, "convolve(_)") == 0)
+                return bitmapConvolve;
+            if (strcmp(signature, "colorMatrix(_)") == 0)
+                return bitmapColorMatrix;
+            if (strcmp(signature, "blend(_,_,_,_)") == 0)
+                return bitmapBlend;
+            if (strcmp(signature, "blend(_,_,_,_,_)") == 0)
+                return bitmapBlend2;
+            if (strcmp(signature, "blendRec(_,_,_,_,_,_,_,_)") == 0)
+                return bitmapBlendRec;
+            if (strcmp(signature, "blendRec(_,_,_,_,_,_,_,_,_)") == 0)
+                return bitmapBlendRec2;
             if (strcmp(signature, "text(_,_,_,_)") == 0)
                 return bitmapText;
+            if (strcmp(signature, "text(_,_,_)") == 0)
+                return bitmapText2;
+            if (strcmp(signature, "text(_,_,_,_,_)") == 0)
+                return bitmapText3;
+            if (strcmp(signature, "draw(_)") == 0)
+                return bitmapDraw;
+        }
+        else if (strcmp(className, "BitmapLoad") == 0)
+        {
+            if (strcmp(signature, "init create(_)") == 0)
+                return bitmapLoadCreate;
+            if (strcmp(signature, "path") == 0)
+                return bitmapLoadPath;
+            if (strcmp(signature, "done") == 0)
+                return bitmapLoadDone;
+            if (strcmp(signature, "error") == 0)
+                return bitmapLoadError;
+            if (strcmp(signature, "bitmap") == 0)
+                return bitmapLoadBitmap;
+        }
+        else if (strcmp(className, "BitmapSave") == 0)
+        {
+            if (strcmp(signature, "init create(_,_)") == 0)
+                return bitmapSaveCreate;
+            if (strcmp(signature, "path") == 0)
+                return bitmapSavePath;
+            if (strcmp(signature, "done") == 0)
+                return bitmapSaveDone;
+            if (strcmp(signature, "error") == 0)
+                return bitmapSaveError;
+            if (strcmp(signature, "wait()") == 0)
+                return bitmapSaveWait;
         }
         else if (strcmp(className, "Font") == 0)
         {
             if (strcmp(signature, "init create(_,_,_)") == 0)
                 return fontCreate;
+            if (strcmp(signature, "init truetype(_,_)") == 0)
+                return fontTrueType;
             if (strcmp(signature, "destroy()") == 0)
                 return fontDestroy;
+            if (strcmp(signature, "measure(_)") == 0)
+                return fontMeasure;
+            if (strcmp(signature, "wrap(_,_)") == 0)
+                return fontWrap;
+            if (strcmp(signature, "render(_,_)") == 0)
+                return fontRender;
+        }
+        else if (strcmp(className, "TextLayout") == 0)
+        {
+            if (strcmp(signature, "init create(_,_,_)") == 0)
+                return textLayoutCreate;
+            if (strcmp(signature, "width") == 0)
+                return textLayoutWidth;
+            if (strcmp(signature, "height") == 0)
+                return textLayoutHeight;
+            if (strcmp(signature, "runCount") == 0)
+                return textLayoutRunCount;
+            if (strcmp(signature, "run(_)") == 0)
+                return textLayoutRun;
+            if (strcmp(signature, "glyphCount") == 0)
+                return textLayoutGlyphCount;
+            if (strcmp(signature, "glyph(_)") == 0)
+                return textLayoutGlyph;
+        }
+        else if (strcmp(className, "DrawList") == 0)
+        {
+            if (strcmp(signature, "init create()") == 0)
+                return drawListCreate;
+            if (strcmp(signature, "reset()") == 0)
+                return drawListReset;
+            if (strcmp(signature, "count") == 0)
+                return drawListCount;
+            if (strcmp(signature, "sorted") == 0)
+                return drawListSorted;
+            if (strcmp(signature, "sorted=(_)") == 0)
+                return drawListSortedSet;
+            if (strcmp(signature, "tiled") == 0)
+                return drawListTiled;
+            if (strcmp(signature, "tiled=(_)") == 0)
+                return drawListTiledSet;
+            if (strcmp(signature, "clear(_)") == 0)
+                return drawListClear;
+            if (strcmp(signature, "rectangle(_,_,_,_,_)") == 0)
+                return drawListRectangle;
+            if (strcmp(signature, "blit(_,_,_)") == 0)
+                return drawListBlit;
+            if (strcmp(signature, "blit(_,_,_,_)") == 0)
+                return drawListBlit2;
+            if (strcmp(signature, "blitRec(_,_,_,_,_,_,_)") == 0)
+                return drawListBlitRec;
+            if (strcmp(signature, "blitRec(_,_,_,_,_,_,_,_)") == 0)
+                return drawListBlitRec2;
+            if (strcmp(signature, "text(_,_,_,_)") == 0)
+                return drawListText;
+        }
+        else if (strcmp(className, "IndexedBitmap") == 0)
+        {
+            if (strcmp(signature, "init create(_,_)") == 0)
+                return indexedBitmapCreate;
+            if (strcmp(signature, "destroy()") == 0)
+                return indexedBitmapDestroy;
+            if (strcmp(signature, "width") == 0)
+                return indexedBitmapWidth;
+            if (strcmp(signature, "height") == 0)
+                return indexedBitmapHeight;
+            if (strcmp(signature, "get(_,_)") == 0)
+                return indexedBitmapGet;
+            if (strcmp(signature, "set(_,_,_)") == 0)
+                return indexedBitmapSet;
+            if (strcmp(signature, "clear(_)") == 0)
+                return indexedBitmapClear;
+            if (strcmp(signature, "rectangle(_,_,_,_,_)") == 0)
+                return indexedBitmapRectangle;
+            if (strcmp(signature, "blit(_,_,_)") == 0)
+                return indexedBitmapBlit;
+            if (strcmp(signature, "blit(_,_,_,_)") == 0)
+                return indexedBitmapBlit2;
+            if (strcmp(signature, "blitRec(_,_,_,_,_,_,_)") == 0)
+                return indexedBitmapBlitRec;
+            if (strcmp(signature, "blitRec(_,_,_,_,_,_,_,_)") == 0)
+                return indexedBitmapBlitRec2;
+            if (strcmp(signature, "palette(_)") == 0)
+                return indexedBitmapPalette;
+            if (strcmp(signature, "setPalette(_,_)") == 0)
+                return indexedBitmapSetPalette;
+            if (strcmp(signature, "rotatePalette(_,_,_)") == 0)
+                return indexedBitmapRotatePalette;
+            if (strcmp(signature, "copyFrom(_)") == 0)
+                return indexedBitmapCopyFrom;
+            if (strcmp(signature, "expand(_)") == 0)
+                return indexedBitmapExpand;
+        }
+        else if (strcmp(className, "Packer") == 0)
+        {
+            if (strcmp(signature, "init create(_,_)") == 0)
+                return packerCreate;
+            if (strcmp(signature, "width") == 0)
+                return packerWidth;
+            if (strcmp(signature, "height") == 0)
+                return packerHeight;
+            if (strcmp(signature, "insert(_,_)") == 0)
+                return packerInsert;
+            if (strcmp(signature, "reset()") == 0)
+                return packerReset;
         }
         else if (strcmp(className, "Pixel") == 0)
         {
@@ -196,8 +435,10 @@ static WrenForeignMethodFn wrenBindForeignMethod(WrenVM *vm, const char *module,
                 return windowCreate;
             if (strcmp(signature, "init create(_,_,_)") == 0)
                 return windowCreate2;
-            if (strcmp(signature, "update(_)") == 0)
+            if (strcmp(signature, "update_(_)") == 0)
                 return windowUpdate;
+            if (strcmp(signature, "updateIndexed_(_)") == 0)
+                return windowUpdateIndexed;
             if (strcmp(signature, "close()") == 0)
                 return windowClose;
             if (strcmp(signature, "keyDown(_)") == 0)
@@ -232,11 +473,47 @@ static WrenForeignMethodFn wrenBindForeignMethod(WrenVM *vm, const char *module,
                 return windowTargetFps;
             if (strcmp(signature, "targetFps=(_)") == 0)
                 return windowTargetFpsSet;
+            if (strcmp(signature, "startRecording_(_,_,_)") == 0)
+                return windowStartRecording;
+            if (strcmp(signature, "stopRecording()") == 0)
+                return windowStopRecording;
+            if (strcmp(signature, "recording") == 0)
+                return windowRecording;
+            if (strcmp(signature, "recordingStats") == 0)
+                return windowRecordingStats;
         }
     }
     else
     {
-        if (strcmp(className, "OS") == 0)
+        if (strcmp(className, "Bitmap") == 0)
+        {
+            if (strcmp(signature, "poolStats") == 0)
+                return bitmapPoolStats;
+            if (strcmp(signature, "trimPool()") == 0)
+                return bitmapTrimPool;
+            if (strcmp(signature, "cacheStats") == 0)
+                return bitmapCacheStats;
+            if (strcmp(signature, "cacheBudget") == 0)
+                return bitmapCacheBudget;
+            if (strcmp(signature, "cacheBudget=(_)") == 0)
+                return bitmapCacheBudgetSet;
+            if (strcmp(signature, "pngCompression") == 0)
+                return bitmapPngCompression;
+            if (strcmp(signature, "pngCompression=(_)") == 0)
+                return bitmapPngCompressionSet;
+        }
+        else if (strcmp(className, "Font") == 0)
+        {
+            if (strcmp(signature, "glyphCacheStats") == 0)
+                return fontGlyphCacheStats;
+            if (strcmp(signature, "renderCacheStats") == 0)
+                return fontRenderCacheStats;
+            if (strcmp(signature, "renderCacheBudget") == 0)
+                return fontRenderCacheBudget;
+            if (strcmp(signature, "renderCacheBudget=(_)") == 0)
+                return fontRenderCacheBudgetSet;
+        }
+        else if (strcmp(className, "OS") == 0)
         {
             if (strcmp(signature, "name") == 0)
                 return osName;
@@ -246,6 +523,8 @@ static WrenForeignMethodFn wrenBindForeignMethod(WrenVM *vm, const char *module,
                 return osArgs;
             if (strcmp(signature, "readLine()") == 0)
                 return osReadLine;
+            if (strcmp(signature, "simd") == 0)
+                return osSimd;
         }
     }
 
@@ -255,6 +534,8 @@ static WrenForeignMethodFn wrenBindForeignMethod(WrenVM *vm, const char *module,
 int main(int argc, char **argv)
 {
     setArgs(argc, argv);
+    rasterInit();
+    poolInit();
 
     checkEmbedded(argv[0], &embedded, &count);
 
@@ -280,7 +561,9 @@ int main(int argc, char **argv)
         }
 
         freeEmbedded(embedded, count);
+        releaseHeldHandles(vm);
         wrenFreeVM(vm);
+        waitForSaves();
 
         return 0;
     }
@@ -397,7 +680,9 @@ int main(int argc, char **argv)
     wrenInterpret(vm, argv[1], source);
 
     free(source);
+    releaseHeldHandles(vm);
     wrenFreeVM(vm);
+    waitForSaves();
 
     return 0;
 }
@@ -0,0 +1,458 @@
+#include "filter.h"
+
+#include "raster.h"
+#include "thread.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bands handed out per thread, so one slow band doesn't leave the rest idle.
+#define BANDS_PER_THREAD 4
+
+// Fraction bits of the fixed point blur weights. A weight has to fit the
+// signed 16 bits raster.accumulate takes.
+#define WEIGHT_BITS 14
+
+typedef struct FilterPass
+{
+    unsigned int *pixels;
+    int width;
+    int height;
+    int pitch;
+
+    // Scratch image between passes, tmpPitch pixels per row.
+    unsigned int *tmp;
+    int tmpPitch;
+
+    // Rows are split into bandCount bands of bandRows rows. Every band has
+    // an accumulator for each byte of a row and a row of rowSize pixels.
+    int bandCount;
+    int bandRows;
+    int *acc;
+    unsigned int *row;
+    int rowSize;
+
+    const int *weights;
+    int radius;
+    int size;
+    float scale;
+    const float *matrix;
+} FilterPass;
+
+static int clampInt(int value, int min, int max)
+{
+    return value < min ? min : value > max ? max : value;
+}
+
+static unsigned int *pixelRow(FilterPass *pass, int y)
+{
+    return pass->pixels + (size_t)y * pass->pitch;
+}
+
+static unsigned int *tmpRow(FilterPass *pass, int y)
+{
+    return pass->tmp + (size_t)y * pass->tmpPitch;
+}
+
+// Copies a row into dst with radius copies of its edge pixels on each side.
+static void padRow(unsigned int *dst, const unsigned int *src, int width, int radius)
+{
+    for (int i = 0; i < radius; i++)
+    {
+        dst[i] = src[0];
+        dst[radius + width + i] = src[width - 1];
+    }
+
+    raster.copy(dst + radius, src, width);
+}
+
+// Picks the bands and allocates their scratch. Bands get at least minRows
+// rows, for passes that pay a setup cost at the start of every band.
+static bool startBands(FilterPass *pass, int minRows, bool needsAcc, int rowSize)
+{
+    int bandCount = (jobsWorkerCount() + 1) * BANDS_PER_THREAD;
+    int maxBands = pass->height / (minRows > 1 ? minRows : 1);
+    if (bandCount > maxBands)
+        bandCount = maxBands;
+    if (bandCount < 1)
+        bandCount = 1;
+
+    pass->bandRows = (pass->height + bandCount - 1) / bandCount;
+    pass->bandCount = (pass->height + pass->bandRows - 1) / pass->bandRows;
+    pass->rowSize = rowSize;
+    pass->acc = NULL;
+    pass->row = NULL;
+
+    if (needsAcc)
+    {
+        pass->acc = (int *)malloc((size_t)pass->bandCount * pass->width * 4 * sizeof(int));
+        if (pass->acc == NULL)
+            return false;
+    }
+
+    if (rowSize > 0)
+    {
+        pass->row = (unsigned int *)malloc((size_t)pass->bandCount * rowSize * sizeof(unsigned int));
+        if (pass->row == NULL)
+        {
+            free(pass->acc);
+            pass->acc = NULL;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void endBands(FilterPass *pass)
+{
+    free(pass->acc);
+    free(pass->row);
+    pass->acc = NULL;
+    pass->row = NULL;
+}
+
+static void bandRange(FilterPass *pass, int index, int *y1, int *y2)
+{
+    *y1 = index * pass->bandRows;
+    *y2 = *y1 + pass->bandRows;
+    if (*y2 > pass->height)
+        *y2 = pass->height;
+}
+
+static int *bandAcc(FilterPass *pass, int index)
+{
+    return pass->acc + (size_t)index * pass->width * 4;
+}
+
+static unsigned int *bandRow(FilterPass *pass, int index)
+{
+    return pass->row + (size_t)index * pass->rowSize;
+}
+
+// Horizontal Gaussian pass from the pixels into tmp.
+static void blurRows(void *data, int index)
+{
+    FilterPass *pass = (FilterPass *)data;
+    int *acc = bandAcc(pass, index);
+    unsigned int *row = bandRow(pass, index);
+    int count = pass->width * 4;
+    int taps = pass->radius * 2 + 1;
+
+    int y1, y2;
+    bandRange(pass, index, &y1, &y2);
+
+    for (int y = y1; y < y2; y++)
+    {
+        padRow(row, pixelRow(pass, y), pass->width, pass->radius);
+
+        memset(acc, 0, count * sizeof(int));
+        for (int k = 0; k < taps; k++)
+            raster.accumulate(acc, (const unsigned char *)(row + k), count, pass->weights[k]);
+
+        raster.pack((unsigned char *)tmpRow(pass, y), acc, count, pass->scale);
+    }
+}
+
+// Vertical Gaussian pass from tmp back into the pixels.
+static void blurColumns(void *data, int index)
+{
+    FilterPass *pass = (FilterPass *)data;
+    int *acc = bandAcc(pass, index);
+    int count = pass->width * 4;
+    int taps = pass->radius * 2 + 1;
+
+    int y1, y2;
+    bandRange(pass, index, &y1, &y2);
+
+    for (int y = y1; y < y2; y++)
+    {
+        memset(acc, 0, count * sizeof(int));
+        for (int k = 0; k < taps; k++)
+        {
+            int sy = clampInt(y + k - pass->radius, 0, pass->height - 1);
+            raster.accumulate(acc, (const unsigned char *)tmpRow(pass, sy), count, pass->weights[k]);
+        }
+
+        raster.pack((unsigned char *)pixelRow(pass, y), acc, count, pass->scale);
+    }
+}
+
+bool filterBlur(unsigned int *pixels, int width, int height, int pitch, double radius)
+{
+    int r = (int)ceil(radius);
+    if (r < 1 || width <= 0 || height <= 0)
+        return true;
+
+    int taps = r * 2 + 1;
+    int *weights = (int *)malloc(taps * sizeof(int));
+    unsigned int *tmp = (unsigned int *)malloc((size_t)width * height * sizeof(unsigned int));
+    if (weights == NULL || tmp == NULL)
+    {
+        free(weights);
+        free(tmp);
+        return false;
+    }
+
+    double sigma = radius / 3.0;
+    double total = 0.0;
+    for (int k = -r; k <= r; k++)
+        total += exp(-(k * k) / (2.0 * sigma * sigma));
+
+    // Rounding loses a little of the total, which goes back to the center so
+    // flat areas keep their exact color.
+    int sum = 0;
+    for (int k = -r; k <= r; k++)
+    {
+        weights[k + r] = (int)(exp(-(k * k) / (2.0 * sigma * sigma)) / total * (1 << WEIGHT_BITS) + 0.5);
+        sum += weights[k + r];
+    }
+    weights[r] += (1 << WEIGHT_BITS) - sum;
+
+    FilterPass pass = {0};
+    pass.pixels = pixels;
+    pass.width = width;
+    pass.height = height;
+    pass.pitch = pitch;
+    pass.tmp = tmp;
+    pass.tmpPitch = width;
+    pass.weights = weights;
+    pass.radius = r;
+    pass.scale = 1.0f / (1 << WEIGHT_BITS);
+
+    bool ok = startBands(&pass, 1, true, width + r * 2);
+    if (ok)
+    {
+        jobsParallel(pass.bandCount, blurRows, &pass);
+        jobsParallel(pass.bandCount, blurColumns, &pass);
+        endBands(&pass);
+    }
+
+    free(weights);
+    free(tmp);
+    return ok;
+}
+
+// Horizontal box pass from the pixels into tmp, keeping a running sum per
+// channel as the window slides along the row.
+static void boxRows(void *data, int index)
+{
+    FilterPass *pass = (FilterPass *)data;
+    int width = pass->width;
+    int r = pass->radius;
+
+    int y1, y2;
+    bandRange(pass, index, &y1, &y2);
+
+    for (int y = y1; y < y2; y++)
+    {
+        const unsigned char *src = (const unsigned char *)pixelRow(pass, y);
+        unsigned char *dst = (unsigned char *)tmpRow(pass, y);
+
+        int sum[4] = {0, 0, 0, 0};
+        for (int k = -r; k <= r; k++)
+        {
+            const unsigned char *p = src + clampInt(k, 0, width - 1) * 4;
+            for (int c = 0; c < 4; c++)
+                sum[c] += p[c];
+        }
+
+        for (int x = 0; x < width; x++)
+        {
+            const unsigned char *in = src + clampInt(x + r + 1, 0, width - 1) * 4;
+            const unsigned char *out = src + clampInt(x - r, 0, width - 1) * 4;
+
+            for (int c = 0; c < 4; c++)
+            {
+                dst[x * 4 + c] = (unsigned char)(sum[c] * pass->scale + 0.5f);
+                sum[c] += in[c] - out[c];
+            }
+        }
+    }
+}
+
+// Vertical box pass from tmp back into the pixels. The sums of a whole row
+// slide down together: each step adds the row entering the window and takes
+// away the one leaving it.
+static void boxColumns(void *data, int index)
+{
+    FilterPass *pass = (FilterPass *)data;
+    int *acc = bandAcc(pass, index);
+    int count = pass->width * 4;
+    int r = pass->radius;
+    int last = pass->height - 1;
+
+    int y1, y2;
+    bandRange(pass, index, &y1, &y2);
+
+    memset(acc, 0, count * sizeof(int));
+    for (int k = -r; k <= r; k++)
+        raster.accumulate(acc, (const unsigned char *)tmpRow(pass, clampInt(y1 + k, 0, last)), count, 1);
+
+    for (int y = y1; y < y2; y++)
+    {
+        raster.pack((unsigned char *)pixelRow(pass, y), acc, count, pass->scale);
+
+        if (y + 1 < y2)
+        {
+            raster.accumulate(acc, (const unsigned char *)tmpRow(pass, clampInt(y + r + 1, 0, last)), count, 1);
+            raster.accumulate(acc, (const unsigned char *)tmpRow(pass, clampInt(y - r, 0, last)), count, -1);
+        }
+    }
+}
+
+bool filterBoxBlur(unsigned int *pixels, int width, int height, int pitch, int radius)
+{
+    if (radius < 1 || width <= 0 || height <= 0)
+        return true;
+
+    unsigned int *tmp = (unsigned int *)malloc((size_t)width * height * sizeof(unsigned int));
+    if (tmp == NULL)
+        return false;
+
+    FilterPass pass = {0};
+    pass.pixels = pixels;
+    pass.width = width;
+    pass.height = height;
+    pass.pitch = pitch;
+    pass.tmp = tmp;
+    pass.tmpPitch = width;
+    pass.radius = radius;
+    pass.scale = 1.0f / (radius * 2 + 1);
+
+    // Every band of the vertical pass starts by summing 2 * radius + 1 rows,
+    // so bands are kept at least that tall.
+    bool ok = startBands(&pass, radius * 2 + 1, true, 0);
+    if (ok)
+    {
+        jobsParallel(pass.bandCount, boxRows, &pass);
+        jobsParallel(pass.bandCount, boxColumns, &pass);
+        endBands(&pass);
+    }
+
+    free(tmp);
+    return ok;
+}
+
+// Convolves rows of the padded copy in tmp into the pixels, then puts back
+// the alpha of every pixel.
+static void convolveRows(void *data, int index)
+{
+    FilterPass *pass = (FilterPass *)data;
+    int *acc = bandAcc(pass, index);
+    int count = pass->width * 4;
+    int size = pass->size;
+
+    int y1, y2;
+    bandRange(pass, index, &y1, &y2);
+
+    for (int y = y1; y < y2; y++)
+    {
+        memset(acc, 0, count * sizeof(int));
+        for (int ky = 0; ky < size; ky++)
+        {
+            const unsigned int *src = tmpRow(pass, y + ky);
+            for (int kx = 0; kx < size; kx++)
+                raster.accumulate(acc, (const unsigned char *)(src + kx), count, pass->weights[ky * size + kx]);
+        }
+
+        unsigned int *dst = pixelRow(pass, y);
+        raster.pack((unsigned char *)dst, acc, count, pass->scale);
+
+        const unsigned int *center = tmpRow(pass, y + pass->radius) + pass->radius;
+        for (int x = 0; x < pass->width; x++)
+            dst[x] = (dst[x] & 0x00FFFFFF) | (center[x] & 0xFF000000);
+    }
+}
+
+bool filterConvolve(unsigned int *pixels, int width, int height, int pitch, const float *kernel, int size)
+{
+    if (width <= 0 || height <= 0 || size <= 0)
+        return true;
+
+    int r = size / 2;
+    int taps = size * size;
+
+    // Weights get as many fraction bits as fit in 16 bits next to the
+    // largest one.
+    float largest = 0.0f;
+    for (int i = 0; i < taps; i++)
+    {
+        if (fabsf(kernel[i]) > largest)
+            largest = fabsf(kernel[i]);
+    }
+
+    int bits = 12;
+    while (bits > 0 && largest * (1 << bits) > 32767.0f)
+        bits--;
+
+    int *weights = (int *)malloc(taps * sizeof(int));
+    unsigned int *tmp = (unsigned int *)malloc((size_t)(width + r * 2) * (height + r * 2) * sizeof(unsigned int));
+    if (weights == NULL || tmp == NULL)
+    {
+        free(weights);
+        free(tmp);
+        return false;
+    }
+
+    for (int i = 0; i < taps; i++)
+    {
+        float w = kernel[i] * (1 << bits);
+        w = w > 32767.0f ? 32767.0f : w < -32767.0f ? -32767.0f : w;
+        weights[i] = (int)lroundf(w);
+    }
+
+    FilterPass pass = {0};
+    pass.pixels = pixels;
+    pass.width = width;
+    pass.height = height;
+    pass.pitch = pitch;
+    pass.tmp = tmp;
+    pass.tmpPitch = width + r * 2;
+    pass.weights = weights;
+    pass.radius = r;
+    pass.size = size;
+    pass.scale = 1.0f / (1 << bits);
+
+    for (int y = 0; y < height + r * 2; y++)
+        padRow(tmpRow(&pass, y), pixelRow(&pass, clampInt(y - r, 0, height - 1)), width, r);
+
+    bool ok = startBands(&pass, 1, true, 0);
+    if (ok)
+    {
+        jobsParallel(pass.bandCount, convolveRows, &pass);
+        endBands(&pass);
+    }
+
+    free(weights);
+    free(tmp);
+    return ok;
+}
+
+static void colorMatrixRows(void *data, int index)
+{
+    FilterPass *pass = (FilterPass *)data;
+
+    int y1, y2;
+    bandRange(pass, index, &y1, &y2);
+
+    for (int y = y1; y < y2; y++)
+        raster.colorMatrix(pixelRow(pass, y), pixelRow(pass, y), pass->width, pass->matrix);
+}
+
+void filterColorMatrix(unsigned int *pixels, int width, int height, int pitch, const float *matrix)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    FilterPass pass = {0};
+    pass.pixels = pixels;
+    pass.width = width;
+    pass.height = height;
+    pass.pitch = pitch;
+    pass.matrix = matrix;
+
+    startBands(&pass, 1, false, 0);
+    jobsParallel(pass.bandCount, colorMatrixRows, &pass);
+}
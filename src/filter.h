@@ -0,0 +1,26 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdbool.h>
+
+#define FILTER_MAX_KERNEL_SIZE 15
+
+// Whole-image filters for Bitmap. Each works in place on rows of 32-bit ARGB
+// pixels that are pitch pixels apart, runs its inner loops through the raster
+// kernels and splits the rows into bands for the job pool. The ones that need
+// scratch memory return false when it can't be allocated, leaving the pixels
+// untouched.
+//
+// filterBlur is a separable Gaussian whose kernel reaches radius pixels, three
+// standard deviations, to each side. filterBoxBlur averages a square of
+// 2 * radius + 1 pixels using running sums, so its cost doesn't grow with the
+// radius. filterConvolve applies a size x size kernel, size being odd and at
+// most FILTER_MAX_KERNEL_SIZE, and keeps the alpha of every pixel.
+// filterColorMatrix maps the channels of every pixel through a 4x5 matrix in
+// the same layout as raster.colorMatrix.
+bool filterBlur(unsigned int *pixels, int width, int height, int pitch, double radius);
+bool filterBoxBlur(unsigned int *pixels, int width, int height, int pitch, int radius);
+bool filterConvolve(unsigned int *pixels, int width, int height, int pitch, const float *kernel, int size);
+void filterColorMatrix(unsigned int *pixels, int width, int height, int pitch, const float *matrix);
+
+#endif
@@ -0,0 +1,135 @@
+#include "packer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool skylineInit(Packer *packer, int width, int height)
+{
+    packer->width = width;
+    packer->height = height;
+
+    // Every node is at least one pixel wide, so there are never more nodes
+    // than columns.
+    packer->nodes = (SkylineNode *)malloc((width + 1) * sizeof(SkylineNode));
+    if (packer->nodes == NULL)
+        return false;
+
+    skylineReset(packer);
+    return true;
+}
+
+void skylineFree(Packer *packer)
+{
+    free(packer->nodes);
+    packer->nodes = NULL;
+}
+
+void skylineReset(Packer *packer)
+{
+    SkylineNode node = {0, 0, packer->width};
+    packer->nodes[0] = node;
+    packer->count = 1;
+}
+
+// Returns the y a width x height rectangle would sit at with its left edge on
+// node index, or -1 if it runs past the right or bottom edge.
+static int skylineFit(Packer *packer, int index, int width, int height)
+{
+    int x = packer->nodes[index].x;
+    if (x + width > packer->width)
+        return -1;
+
+    int y = 0;
+    int remaining = width;
+    for (int i = index; remaining > 0; i++)
+    {
+        if (packer->nodes[i].y > y)
+            y = packer->nodes[i].y;
+        if (y + height > packer->height)
+            return -1;
+
+        remaining -= packer->nodes[i].width;
+    }
+
+    return y;
+}
+
+// Raises the skyline under a rectangle placed at node index and merges
+// neighbours left at the same height.
+static void skylineAdd(Packer *packer, int index, int x, int y, int width, int height)
+{
+    SkylineNode *nodes = packer->nodes;
+
+    memmove(nodes + index + 1, nodes + index, (packer->count - index) * sizeof(SkylineNode));
+    SkylineNode node = {x, y + height, width};
+    nodes[index] = node;
+    packer->count++;
+
+    int right = x + width;
+    int i = index + 1;
+    while (i < packer->count && nodes[i].x < right)
+    {
+        int overlap = right - nodes[i].x;
+        if (overlap < nodes[i].width)
+        {
+            nodes[i].x += overlap;
+            nodes[i].width -= overlap;
+            break;
+        }
+
+        memmove(nodes + i, nodes + i + 1, (packer->count - i - 1) * sizeof(SkylineNode));
+        packer->count--;
+    }
+
+    for (i = 0; i < packer->count - 1;)
+    {
+        if (nodes[i].y == nodes[i + 1].y)
+        {
+            nodes[i].width += nodes[i + 1].width;
+            memmove(nodes + i + 1, nodes + i + 2, (packer->count - i - 2) * sizeof(SkylineNode));
+            packer->count--;
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+// Places a rectangle bottom-left first: the spot with the lowest top edge
+// wins, and ties go to the narrower stretch of skyline. Returns false when the
+// rectangle doesn't fit.
+bool skylinePlace(Packer *packer, int width, int height, int *x, int *y)
+{
+    if (width <= 0 || height <= 0)
+        return false;
+
+    int best = -1;
+    int bestTop = 0;
+    int bestWidth = 0;
+    int bestY = 0;
+
+    for (int i = 0; i < packer->count; i++)
+    {
+        int fitY = skylineFit(packer, i, width, height);
+        if (fitY < 0)
+            continue;
+
+        int top = fitY + height;
+        if (best < 0 || top < bestTop || (top == bestTop && packer->nodes[i].width < bestWidth))
+        {
+            best = i;
+            bestTop = top;
+            bestWidth = packer->nodes[i].width;
+            bestY = fitY;
+        }
+    }
+
+    if (best < 0)
+        return false;
+
+    *x = packer->nodes[best].x;
+    *y = bestY;
+    skylineAdd(packer, best, *x, bestY, width, height);
+    return true;
+}
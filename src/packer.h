@@ -0,0 +1,29 @@
+#ifndef PACKER_H
+#define PACKER_H
+
+#include <stdbool.h>
+
+typedef struct SkylineNode
+{
+    int x;
+    int y;
+    int width;
+} SkylineNode;
+
+// Skyline rectangle packer behind Atlas and the glyph atlas of TrueType fonts.
+// The nodes describe the top edge of the packed area from left to right; each
+// new rectangle sits on the lowest stretch of skyline it fits on.
+typedef struct Packer
+{
+    int width;
+    int height;
+    SkylineNode *nodes;
+    int count;
+} Packer;
+
+bool skylineInit(Packer *packer, int width, int height);
+void skylineFree(Packer *packer);
+void skylineReset(Packer *packer);
+bool skylinePlace(Packer *packer, int width, int height, int *x, int *y);
+
+#endif
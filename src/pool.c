@@ -0,0 +1,148 @@
+#include "pool.h"
+#include "thread.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define POOL_ALIGN 64
+#define POOL_CLASSES 256
+#define POOL_LIMIT (64 * 1024 * 1024)
+
+typedef struct PoolBlock
+{
+    struct PoolBlock *next;
+} PoolBlock;
+
+static Mutex *poolMutex = NULL;
+static PoolBlock *freeLists[POOL_CLASSES];
+static PoolStats stats;
+
+// Maps a size to its class. Each power of two is split into four classes, so
+// rounding up wastes less than a quarter of a buffer.
+static int sizeClass(size_t size, size_t *classSize)
+{
+    if (size <= POOL_ALIGN)
+    {
+        *classSize = POOL_ALIGN;
+        return 0;
+    }
+
+    int bits = 0;
+    while (((size - 1) >> (bits + 1)) != 0)
+        bits++;
+
+    size_t base = (size_t)1 << bits;
+    size_t step = base / 4;
+    size_t k = (size - base + step - 1) / step;
+
+    *classSize = base + k * step;
+    return (bits - 6) * 4 + (int)k;
+}
+
+// The pointer malloc returned is stored just before the aligned block.
+static void *alignedAlloc(size_t size)
+{
+    void *raw = malloc(size + POOL_ALIGN + sizeof(void *));
+    if (raw == NULL)
+        return NULL;
+
+    uintptr_t aligned = ((uintptr_t)raw + sizeof(void *) + POOL_ALIGN - 1) & ~(uintptr_t)(POOL_ALIGN - 1);
+    ((void **)aligned)[-1] = raw;
+    return (void *)aligned;
+}
+
+static void alignedFree(void *buffer)
+{
+    free(((void **)buffer)[-1]);
+}
+
+void poolInit(void)
+{
+    if (poolMutex == NULL)
+        poolMutex = mutexCreate();
+}
+
+void *poolAlloc(size_t size)
+{
+    size_t classSize;
+    int index = sizeClass(size, &classSize);
+
+    mutexLock(poolMutex);
+
+    PoolBlock *block = freeLists[index];
+    if (block != NULL)
+    {
+        freeLists[index] = block->next;
+        stats.hits++;
+        stats.pooled -= classSize;
+        stats.live += classSize;
+        mutexUnlock(poolMutex);
+        return block;
+    }
+
+    stats.misses++;
+    mutexUnlock(poolMutex);
+
+    void *buffer = alignedAlloc(classSize);
+    if (buffer == NULL)
+        return NULL;
+
+    mutexLock(poolMutex);
+    stats.live += classSize;
+    mutexUnlock(poolMutex);
+
+    return buffer;
+}
+
+void poolFree(void *buffer, size_t size)
+{
+    if (buffer == NULL)
+        return;
+
+    size_t classSize;
+    int index = sizeClass(size, &classSize);
+
+    mutexLock(poolMutex);
+
+    stats.live -= classSize;
+    if (stats.pooled + classSize <= POOL_LIMIT)
+    {
+        PoolBlock *block = (PoolBlock *)buffer;
+        block->next = freeLists[index];
+        freeLists[index] = block;
+        stats.pooled += classSize;
+        buffer = NULL;
+    }
+
+    mutexUnlock(poolMutex);
+
+    if (buffer != NULL)
+        alignedFree(buffer);
+}
+
+void poolTrim(void)
+{
+    mutexLock(poolMutex);
+
+    for (int i = 0; i < POOL_CLASSES; i++)
+    {
+        while (freeLists[i] != NULL)
+        {
+            PoolBlock *block = freeLists[i];
+            freeLists[i] = block->next;
+            alignedFree(block);
+        }
+    }
+
+    stats.pooled = 0;
+    mutexUnlock(poolMutex);
+}
+
+PoolStats poolStats(void)
+{
+    mutexLock(poolMutex);
+    PoolStats result = stats;
+    mutexUnlock(poolMutex);
+
+    return result;
+}
@@ -0,0 +1,23 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Allocator for bitmap pixel storage. Buffers are 64-byte aligned, and freed
+// buffers are kept in size classes for reuse until the pooled bytes reach a
+// limit. Callers pass the size they allocated with back to poolFree.
+typedef struct PoolStats
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    size_t live;
+    size_t pooled;
+} PoolStats;
+
+void poolInit(void);
+void *poolAlloc(size_t size);
+void poolFree(void *buffer, size_t size);
+void poolTrim(void);
+PoolStats poolStats(void);
+
+#endif
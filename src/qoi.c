@@ -0,0 +1,183 @@
+#include "qoi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+
+#define QOI_BUFFER_SIZE 65536
+
+// Output is gathered in a fixed buffer and written out whenever it fills up,
+// so the encoded image never has to fit in memory.
+typedef struct QoiWriter
+{
+    FILE *file;
+    unsigned char buffer[QOI_BUFFER_SIZE];
+    int length;
+    bool failed;
+} QoiWriter;
+
+static void flush(QoiWriter *writer)
+{
+    if (writer->length > 0 && fwrite(writer->buffer, 1, writer->length, writer->file) != (size_t)writer->length)
+        writer->failed = true;
+
+    writer->length = 0;
+}
+
+static void put(QoiWriter *writer, unsigned char byte)
+{
+    if (writer->length == QOI_BUFFER_SIZE)
+        flush(writer);
+
+    writer->buffer[writer->length++] = byte;
+}
+
+static void put32(QoiWriter *writer, unsigned int value)
+{
+    put(writer, value >> 24);
+    put(writer, value >> 16);
+    put(writer, value >> 8);
+    put(writer, value);
+}
+
+static int hash(unsigned int pixel)
+{
+    unsigned int a = pixel >> 24;
+    unsigned int r = (pixel >> 16) & 0xFF;
+    unsigned int g = (pixel >> 8) & 0xFF;
+    unsigned int b = pixel & 0xFF;
+
+    return (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+}
+
+bool qoiWrite(const char *path, const unsigned int *pixels, int width, int height, int pitch)
+{
+    QoiWriter *writer = (QoiWriter *)malloc(sizeof(QoiWriter));
+    if (writer == NULL)
+        return false;
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL)
+    {
+        free(writer);
+        return false;
+    }
+
+    writer->length = 0;
+    writer->failed = false;
+
+    put(writer, 'q');
+    put(writer, 'o');
+    put(writer, 'i');
+    put(writer, 'f');
+    put32(writer, width);
+    put32(writer, height);
+    put(writer, 4);
+    put(writer, 0);
+
+    unsigned int index[64];
+    memset(index, 0, sizeof(index));
+
+    unsigned int prev = 0xFF000000;
+    int run = 0;
+
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned int *row = pixels + y * pitch;
+
+        for (int x = 0; x < width; x++)
+        {
+            unsigned int pixel = row[x];
+
+            if (pixel == prev)
+            {
+                run++;
+                if (run == 62)
+                {
+                    put(writer, QOI_OP_RUN | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0)
+            {
+                put(writer, QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+
+            int slot = hash(pixel);
+            if (index[slot] == pixel)
+            {
+                put(writer, QOI_OP_INDEX | slot);
+                prev = pixel;
+                continue;
+            }
+
+            index[slot] = pixel;
+
+            unsigned char r = (pixel >> 16) & 0xFF;
+            unsigned char g = (pixel >> 8) & 0xFF;
+            unsigned char b = pixel & 0xFF;
+
+            if ((pixel >> 24) == (prev >> 24))
+            {
+                signed char vr = (signed char)(r - ((prev >> 16) & 0xFF));
+                signed char vg = (signed char)(g - ((prev >> 8) & 0xFF));
+                signed char vb = (signed char)(b - (prev & 0xFF));
+                signed char vgr = vr - vg;
+                signed char vgb = vb - vg;
+
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                {
+                    put(writer, QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                }
+                else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8)
+                {
+                    put(writer, QOI_OP_LUMA | (vg + 32));
+                    put(writer, (vgr + 8) << 4 | (vgb + 8));
+                }
+                else
+                {
+                    put(writer, QOI_OP_RGB);
+                    put(writer, r);
+                    put(writer, g);
+                    put(writer, b);
+                }
+            }
+            else
+            {
+                put(writer, QOI_OP_RGBA);
+                put(writer, r);
+                put(writer, g);
+                put(writer, b);
+                put(writer, pixel >> 24);
+            }
+
+            prev = pixel;
+        }
+    }
+
+    if (run > 0)
+        put(writer, QOI_OP_RUN | (run - 1));
+
+    for (int i = 0; i < 7; i++)
+        put(writer, 0);
+    put(writer, 1);
+
+    flush(writer);
+
+    bool failed = writer->failed;
+    if (fclose(writer->file) != 0)
+        failed = true;
+
+    free(writer);
+    return !failed;
+}
@@ -0,0 +1,11 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include <stdbool.h>
+
+// Writes 32-bit ARGB pixels as a QOI image (https://qoiformat.org), a
+// lossless format that encodes in a single pass and is much faster to write
+// than PNG. Rows are pitch pixels apart.
+bool qoiWrite(const char *path, const unsigned int *pixels, int width, int height, int pitch);
+
+#endif
@@ -0,0 +1,1001 @@
+#include "raster.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RASTER_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define RASTER_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RASTER_TARGET(x) __attribute__((target(x)))
+#else
+#define RASTER_TARGET(x)
+#endif
+
+Raster raster;
+
+static void scalarFill(unsigned int *dst, int count, unsigned int color)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] = color;
+}
+
+static void scalarCopy(unsigned int *dst, const unsigned int *src, int count)
+{
+    memcpy(dst, src, count * sizeof(unsigned int));
+}
+
+static void scalarCopyKeyed(unsigned int *dst, const unsigned int *src, int count, unsigned int key)
+{
+    for (int i = 0; i < count; i++)
+    {
+        unsigned int color = src[i];
+        if (color != key)
+            dst[i] = color;
+    }
+}
+
+// Rounded x / 255 for x <= 255 * 255, exact for every product of two bytes.
+static unsigned int div255(unsigned int x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Blends every channel of s over d by a / 255, two channels per multiply.
+static unsigned int lerpPacked(unsigned int s, unsigned int d, unsigned int a)
+{
+    unsigned int ia = 255 - a;
+    unsigned int rb = (s & 0x00FF00FF) * a + (d & 0x00FF00FF) * ia + 0x00800080;
+    unsigned int ag = ((s >> 8) & 0x00FF00FF) * a + ((d >> 8) & 0x00FF00FF) * ia + 0x00800080;
+
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+
+    return rb | ag;
+}
+
+static unsigned int addPacked(unsigned int s, unsigned int d)
+{
+    unsigned int rb = (s & 0x00FF00FF) + (d & 0x00FF00FF);
+    unsigned int ag = ((s >> 8) & 0x00FF00FF) + ((d >> 8) & 0x00FF00FF);
+
+    unsigned int overflow = rb & 0x01000100;
+    rb = (rb | (overflow - (overflow >> 8))) & 0x00FF00FF;
+    overflow = ag & 0x01000100;
+    ag = (ag | (overflow - (overflow >> 8))) & 0x00FF00FF;
+
+    return rb | (ag << 8);
+}
+
+static unsigned int multiplyPacked(unsigned int s, unsigned int d)
+{
+    unsigned int a = div255((s >> 24) * (d >> 24));
+    unsigned int r = div255(((s >> 16) & 0xFF) * ((d >> 16) & 0xFF));
+    unsigned int g = div255(((s >> 8) & 0xFF) * ((d >> 8) & 0xFF));
+    unsigned int b = div255((s & 0xFF) * (d & 0xFF));
+
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+// Source alpha is replaced by 255 before blending so the destination alpha
+// ends up as a + d * (1 - a), the usual non-premultiplied "over" result.
+static void scalarBlend(unsigned int *dst, const unsigned int *src, int count, BlendMode mode, unsigned int opacity)
+{
+    for (int i = 0; i < count; i++)
+    {
+        unsigned int s = src[i] | 0xFF000000;
+        unsigned int d = dst[i];
+        unsigned int a = mode == BLEND_OPACITY ? opacity : div255((src[i] >> 24) * opacity);
+
+        if (a == 0)
+            continue;
+
+        switch (mode)
+        {
+        case BLEND_ALPHA:
+        case BLEND_OPACITY:
+            dst[i] = lerpPacked(s, d, a);
+            break;
+        case BLEND_ADD:
+            dst[i] = addPacked(lerpPacked(s, 0, a), d);
+            break;
+        case BLEND_MULTIPLY:
+            dst[i] = lerpPacked(multiplyPacked(s, d), d, a);
+            break;
+        }
+    }
+}
+
+static void scalarTint(unsigned int *dst, const unsigned int *src, int count, unsigned int color)
+{
+    unsigned int r = ((color >> 16) & 0xFF) + 1;
+    unsigned int g = ((color >> 8) & 0xFF) + 1;
+    unsigned int b = (color & 0xFF) + 1;
+
+    for (int i = 0; i < count; i++)
+    {
+        unsigned int c = src[i];
+        dst[i] = (c & 0xFF000000) |
+                 ((((c >> 16) & 0xFF) * r >> 8) << 16) |
+                 ((((c >> 8) & 0xFF) * g >> 8) << 8) |
+                 ((c & 0xFF) * b >> 8);
+    }
+}
+
+static void scalarCoverage(unsigned int *dst, const unsigned char *src, int count, unsigned int color)
+{
+    unsigned int s = color | 0xFF000000;
+    unsigned int alpha = color >> 24;
+
+    for (int i = 0; i < count; i++)
+    {
+        unsigned int a = div255(src[i] * alpha);
+        if (a != 0)
+            dst[i] = lerpPacked(s, dst[i], a);
+    }
+}
+
+static void scalarSwapRB(void *dst, const void *src, int count)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+
+    for (int i = 0; i < count * 4; i += 4)
+    {
+        unsigned char first = s[i];
+        d[i] = s[i + 2];
+        d[i + 1] = s[i + 1];
+        d[i + 2] = first;
+        d[i + 3] = s[i + 3];
+    }
+}
+
+static void scalarGrayToArgb(unsigned int *dst, const unsigned char *src, int count)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] = 0xFF000000 | (src[i] * 0x010101u);
+}
+
+static void scalarLookup(unsigned int *dst, const unsigned char *src, int count, const unsigned int *palette)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        dst[i] = palette[src[i]];
+        dst[i + 1] = palette[src[i + 1]];
+        dst[i + 2] = palette[src[i + 2]];
+        dst[i + 3] = palette[src[i + 3]];
+    }
+
+    for (; i < count; i++)
+        dst[i] = palette[src[i]];
+}
+
+static void scalarCopyKeyed8(unsigned char *dst, const unsigned char *src, int count, unsigned char key)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (src[i] != key)
+            dst[i] = src[i];
+    }
+}
+
+static void scalarAccumulate(int *acc, const unsigned char *src, int count, int weight)
+{
+    for (int i = 0; i < count; i++)
+        acc[i] += src[i] * weight;
+}
+
+static unsigned char clampByte(float value)
+{
+    if (value <= 0.0f)
+        return 0;
+    if (value >= 255.0f)
+        return 255;
+    return (unsigned char)value;
+}
+
+static void scalarPack(unsigned char *dst, const int *acc, int count, float scale)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] = clampByte(acc[i] * scale + 0.5f);
+}
+
+static void scalarColorMatrix(unsigned int *dst, const unsigned int *src, int count, const float *matrix)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const unsigned char *s = (const unsigned char *)(src + i);
+        float b0 = s[0], b1 = s[1], b2 = s[2], b3 = s[3];
+
+        unsigned char out[4];
+        for (int c = 0; c < 4; c++)
+            out[c] = clampByte(matrix[16 + c] + b0 * matrix[c] + b1 * matrix[4 + c] + b2 * matrix[8 + c] + b3 * matrix[12 + c] + 0.5f);
+
+        memcpy(dst + i, out, 4);
+    }
+}
+
+#ifdef RASTER_X86
+
+RASTER_TARGET("sse2")
+static void sse2Fill(unsigned int *dst, int count, unsigned int color)
+{
+    int i = 0;
+
+    // Align the destination so the main loop can use aligned stores.
+    while (i < count && ((size_t)(dst + i) & 15) != 0)
+        dst[i++] = color;
+
+    __m128i c = _mm_set1_epi32((int)color);
+    for (; i + 16 <= count; i += 16)
+    {
+        _mm_store_si128((__m128i *)(dst + i), c);
+        _mm_store_si128((__m128i *)(dst + i + 4), c);
+        _mm_store_si128((__m128i *)(dst + i + 8), c);
+        _mm_store_si128((__m128i *)(dst + i + 12), c);
+    }
+    for (; i + 4 <= count; i += 4)
+        _mm_store_si128((__m128i *)(dst + i), c);
+
+    for (; i < count; i++)
+        dst[i] = color;
+}
+
+RASTER_TARGET("sse2")
+static void sse2Copy(unsigned int *dst, const unsigned int *src, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 4));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + i + 8));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + i + 12));
+        _mm_storeu_si128((__m128i *)(dst + i), a);
+        _mm_storeu_si128((__m128i *)(dst + i + 4), b);
+        _mm_storeu_si128((__m128i *)(dst + i + 8), c);
+        _mm_storeu_si128((__m128i *)(dst + i + 12), d);
+    }
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_loadu_si128((const __m128i *)(src + i)));
+
+    for (; i < count; i++)
+        dst[i] = src[i];
+}
+
+RASTER_TARGET("sse2")
+static void sse2CopyKeyed(unsigned int *dst, const unsigned int *src, int count, unsigned int key)
+{
+    __m128i k = _mm_set1_epi32((int)key);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i m = _mm_cmpeq_epi32(s, k);
+        int mask = _mm_movemask_epi8(m);
+
+        // Fully transparent and fully opaque groups skip the blend.
+        if (mask == 0xFFFF)
+            continue;
+        if (mask == 0)
+        {
+            _mm_storeu_si128((__m128i *)(dst + i), s);
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i r = _mm_or_si128(_mm_and_si128(m, d), _mm_andnot_si128(m, s));
+        _mm_storeu_si128((__m128i *)(dst + i), r);
+    }
+
+    scalarCopyKeyed(dst + i, src + i, count - i, key);
+}
+
+RASTER_TARGET("sse2")
+static __m128i sse2Div255(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Blends two pixels unpacked to 16-bit lanes, matching scalarBlend exactly.
+RASTER_TARGET("sse2")
+static __m128i sse2BlendHalf(__m128i s, __m128i d, BlendMode mode, __m128i opacity)
+{
+    __m128i a;
+    if (mode == BLEND_OPACITY)
+        a = opacity;
+    else
+    {
+        a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+        a = sse2Div255(_mm_mullo_epi16(a, opacity));
+    }
+
+    s = _mm_or_si128(s, _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0));
+    __m128i ia = _mm_sub_epi16(_mm_set1_epi16(255), a);
+
+    switch (mode)
+    {
+    case BLEND_ADD:
+        return sse2Div255(_mm_mullo_epi16(s, a));
+    case BLEND_MULTIPLY:
+        s = sse2Div255(_mm_mullo_epi16(s, d));
+        break;
+    default:
+        break;
+    }
+
+    return sse2Div255(_mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, ia)));
+}
+
+RASTER_TARGET("sse2")
+static void sse2Blend(unsigned int *dst, const unsigned int *src, int count, BlendMode mode, unsigned int opacity)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+    __m128i op = _mm_set1_epi16((short)opacity);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+
+        if (mode != BLEND_OPACITY)
+        {
+            __m128i alpha = _mm_and_si128(s, alphaMask);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero)) == 0xFFFF)
+                continue;
+            if (mode == BLEND_ALPHA && opacity == 255 && _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alphaMask)) == 0xFFFF)
+            {
+                _mm_storeu_si128((__m128i *)(dst + i), s);
+                continue;
+            }
+        }
+
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i dLo = _mm_unpacklo_epi8(d, zero);
+        __m128i dHi = _mm_unpackhi_epi8(d, zero);
+        __m128i lo = sse2BlendHalf(_mm_unpacklo_epi8(s, zero), dLo, mode, op);
+        __m128i hi = sse2BlendHalf(_mm_unpackhi_epi8(s, zero), dHi, mode, op);
+        __m128i r = _mm_packus_epi16(lo, hi);
+
+        if (mode == BLEND_ADD)
+            r = _mm_adds_epu8(r, d);
+
+        _mm_storeu_si128((__m128i *)(dst + i), r);
+    }
+
+    scalarBlend(dst + i, src + i, count - i, mode, opacity);
+}
+
+// Multipliers for the bytes of a pixel in tint: the color channels plus one,
+// and 256 for alpha so it stays as it is.
+RASTER_TARGET("sse2")
+static __m128i sse2TintFactors(unsigned int color)
+{
+    short r = (short)(((color >> 16) & 0xFF) + 1);
+    short g = (short)(((color >> 8) & 0xFF) + 1);
+    short b = (short)((color & 0xFF) + 1);
+
+    return _mm_setr_epi16(b, g, r, 256, b, g, r, 256);
+}
+
+// The products fit 16 bits, so the low half of the multiply is exact.
+RASTER_TARGET("sse2")
+static void sse2Tint(unsigned int *dst, const unsigned int *src, int count, unsigned int color)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i factors = sse2TintFactors(color);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), factors), 8);
+        __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), factors), 8);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+
+    scalarTint(dst + i, src + i, count - i, color);
+}
+
+RASTER_TARGET("sse2")
+static void sse2Coverage(unsigned int *dst, const unsigned char *src, int count, unsigned int color)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i s = _mm_set1_epi32((int)(color | 0xFF000000));
+    __m128i s16 = _mm_unpacklo_epi8(s, zero);
+    __m128i alpha = _mm_set1_epi16((short)(color >> 24));
+    __m128i full = _mm_set1_epi16(255);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        int bytes;
+        memcpy(&bytes, src + i, 4);
+        if (bytes == 0)
+            continue;
+        if (bytes == -1 && (color >> 24) == 255)
+        {
+            _mm_storeu_si128((__m128i *)(dst + i), s);
+            continue;
+        }
+
+        // Spread each coverage byte over the four channels of its pixel.
+        __m128i c = _mm_cvtsi32_si128(bytes);
+        c = _mm_unpacklo_epi8(c, c);
+        c = _mm_unpacklo_epi16(c, c);
+
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i a = sse2Div255(_mm_mullo_epi16(_mm_unpacklo_epi8(c, zero), alpha));
+        __m128i lo = sse2Div255(_mm_add_epi16(_mm_mullo_epi16(s16, a), _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, a))));
+        a = sse2Div255(_mm_mullo_epi16(_mm_unpackhi_epi8(c, zero), alpha));
+        __m128i hi = sse2Div255(_mm_add_epi16(_mm_mullo_epi16(s16, a), _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, a))));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+
+    scalarCoverage(dst + i, src + i, count - i, color);
+}
+
+RASTER_TARGET("sse2")
+static void sse2SwapRB(void *dst, const void *src, int count)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+    __m128i keep = _mm_set1_epi32((int)0xFF00FF00);
+    __m128i low = _mm_set1_epi32(0xFF);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i * 4));
+        __m128i r = _mm_and_si128(x, keep);
+        r = _mm_or_si128(r, _mm_and_si128(_mm_srli_epi32(x, 16), low));
+        r = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(x, low), 16));
+        _mm_storeu_si128((__m128i *)(d + i * 4), r);
+    }
+
+    scalarSwapRB(d + i * 4, s + i * 4, count - i);
+}
+
+RASTER_TARGET("sse2")
+static void sse2GrayToArgb(unsigned int *dst, const unsigned char *src, int count)
+{
+    __m128i opaque = _mm_set1_epi8((char)0xFF);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        // Interleaving g with itself and with 0xFF gives g,g,g,0xFF per pixel.
+        __m128i g = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i gg = _mm_unpacklo_epi8(g, g);
+        __m128i ga = _mm_unpacklo_epi8(g, opaque);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi16(gg, ga));
+        _mm_storeu_si128((__m128i *)(dst + i + 4), _mm_unpackhi_epi16(gg, ga));
+
+        gg = _mm_unpackhi_epi8(g, g);
+        ga = _mm_unpackhi_epi8(g, opaque);
+        _mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpacklo_epi16(gg, ga));
+        _mm_storeu_si128((__m128i *)(dst + i + 12), _mm_unpackhi_epi16(gg, ga));
+    }
+
+    scalarGrayToArgb(dst + i, src + i, count - i);
+}
+
+RASTER_TARGET("sse2")
+static void sse2CopyKeyed8(unsigned char *dst, const unsigned char *src, int count, unsigned char key)
+{
+    __m128i k = _mm_set1_epi8((char)key);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i m = _mm_cmpeq_epi8(s, k);
+        int mask = _mm_movemask_epi8(m);
+
+        if (mask == 0xFFFF)
+            continue;
+        if (mask == 0)
+        {
+            _mm_storeu_si128((__m128i *)(dst + i), s);
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i r = _mm_or_si128(_mm_and_si128(m, d), _mm_andnot_si128(m, s));
+        _mm_storeu_si128((__m128i *)(dst + i), r);
+    }
+
+    scalarCopyKeyed8(dst + i, src + i, count - i, key);
+}
+
+RASTER_TARGET("sse2")
+static void sse2Accumulate(int *acc, const unsigned char *src, int count, int weight)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i w = _mm_set1_epi16((short)weight);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        // Pairing every byte with a zero lets madd form one 32-bit product per
+        // lane.
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_unpacklo_epi8(x, zero);
+        __m128i hi = _mm_unpackhi_epi8(x, zero);
+
+        __m128i *a = (__m128i *)(acc + i);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), _mm_madd_epi16(_mm_unpacklo_epi16(lo, zero), w)));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_madd_epi16(_mm_unpackhi_epi16(lo, zero), w)));
+        _mm_storeu_si128(a + 2, _mm_add_epi32(_mm_loadu_si128(a + 2), _mm_madd_epi16(_mm_unpacklo_epi16(hi, zero), w)));
+        _mm_storeu_si128(a + 3, _mm_add_epi32(_mm_loadu_si128(a + 3), _mm_madd_epi16(_mm_unpackhi_epi16(hi, zero), w)));
+    }
+
+    scalarAccumulate(acc + i, src + i, count - i, weight);
+}
+
+RASTER_TARGET("sse2")
+static __m128i sse2PackLanes(const int *acc, __m128 scale)
+{
+    __m128 v = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)acc)), scale), _mm_set1_ps(0.5f));
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+    return _mm_cvttps_epi32(v);
+}
+
+RASTER_TARGET("sse2")
+static void sse2Pack(unsigned char *dst, const int *acc, int count, float scale)
+{
+    __m128 s = _mm_set1_ps(scale);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i a = _mm_packs_epi32(sse2PackLanes(acc + i, s), sse2PackLanes(acc + i + 4, s));
+        __m128i b = _mm_packs_epi32(sse2PackLanes(acc + i + 8, s), sse2PackLanes(acc + i + 12, s));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+    }
+
+    scalarPack(dst + i, acc + i, count - i, scale);
+}
+
+RASTER_TARGET("sse2")
+static void sse2ColorMatrix(unsigned int *dst, const unsigned int *src, int count, const float *matrix)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128 c0 = _mm_loadu_ps(matrix);
+    __m128 c1 = _mm_loadu_ps(matrix + 4);
+    __m128 c2 = _mm_loadu_ps(matrix + 8);
+    __m128 c3 = _mm_loadu_ps(matrix + 12);
+    __m128 offset = _mm_add_ps(_mm_loadu_ps(matrix + 16), _mm_set1_ps(0.5f));
+    __m128 max = _mm_set1_ps(255.0f);
+
+    // One pixel per iteration, its four channels side by side in one vector.
+    for (int i = 0; i < count; i++)
+    {
+        __m128i p = _mm_cvtsi32_si128((int)src[i]);
+        p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(p, zero), zero);
+        __m128 f = _mm_cvtepi32_ps(p);
+
+        __m128 v = offset;
+        v = _mm_add_ps(v, _mm_mul_ps(c0, _mm_shuffle_ps(f, f, 0x00)));
+        v = _mm_add_ps(v, _mm_mul_ps(c1, _mm_shuffle_ps(f, f, 0x55)));
+        v = _mm_add_ps(v, _mm_mul_ps(c2, _mm_shuffle_ps(f, f, 0xAA)));
+        v = _mm_add_ps(v, _mm_mul_ps(c3, _mm_shuffle_ps(f, f, 0xFF)));
+        v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), max);
+
+        __m128i n = _mm_cvttps_epi32(v);
+        n = _mm_packs_epi32(n, n);
+        dst[i] = (unsigned int)_mm_cvtsi128_si32(_mm_packus_epi16(n, n));
+    }
+}
+
+RASTER_TARGET("avx2")
+static void avx2Fill(unsigned int *dst, int count, unsigned int color)
+{
+    int i = 0;
+
+    while (i < count && ((size_t)(dst + i) & 31) != 0)
+        dst[i++] = color;
+
+    __m256i c = _mm256_set1_epi32((int)color);
+    for (; i + 32 <= count; i += 32)
+    {
+        _mm256_store_si256((__m256i *)(dst + i), c);
+        _mm256_store_si256((__m256i *)(dst + i + 8), c);
+        _mm256_store_si256((__m256i *)(dst + i + 16), c);
+        _mm256_store_si256((__m256i *)(dst + i + 24), c);
+    }
+    for (; i + 8 <= count; i += 8)
+        _mm256_store_si256((__m256i *)(dst + i), c);
+
+    for (; i < count; i++)
+        dst[i] = color;
+}
+
+RASTER_TARGET("avx2")
+static void avx2Copy(unsigned int *dst, const unsigned int *src, int count)
+{
+    int i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 8));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(src + i + 16));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(src + i + 24));
+        _mm256_storeu_si256((__m256i *)(dst + i), a);
+        _mm256_storeu_si256((__m256i *)(dst + i + 8), b);
+        _mm256_storeu_si256((__m256i *)(dst + i + 16), c);
+        _mm256_storeu_si256((__m256i *)(dst + i + 24), d);
+    }
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_loadu_si256((const __m256i *)(src + i)));
+
+    for (; i < count; i++)
+        dst[i] = src[i];
+}
+
+RASTER_TARGET("avx2")
+static void avx2CopyKeyed(unsigned int *dst, const unsigned int *src, int count, unsigned int key)
+{
+    __m256i k = _mm256_set1_epi32((int)key);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i m = _mm256_cmpeq_epi32(s, k);
+        int mask = _mm256_movemask_epi8(m);
+
+        if (mask == -1)
+            continue;
+        if (mask == 0)
+        {
+            _mm256_storeu_si256((__m256i *)(dst + i), s);
+            continue;
+        }
+
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_blendv_epi8(s, d, m));
+    }
+
+    scalarCopyKeyed(dst + i, src + i, count - i, key);
+}
+
+RASTER_TARGET("avx2")
+static void avx2Tint(unsigned int *dst, const unsigned int *src, int count, unsigned int color)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i factors = _mm256_broadcastsi128_si256(sse2TintFactors(color));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i lo = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), factors), 8);
+        __m256i hi = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), factors), 8);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+
+    sse2Tint(dst + i, src + i, count - i, color);
+}
+
+RASTER_TARGET("avx2")
+static void avx2SwapRB(void *dst, const void *src, int count)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+    __m256i order = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                     2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(s + i * 4));
+        _mm256_storeu_si256((__m256i *)(d + i * 4), _mm256_shuffle_epi8(x, order));
+    }
+
+    scalarSwapRB(d + i * 4, s + i * 4, count - i);
+}
+
+RASTER_TARGET("avx2")
+static void avx2Lookup(unsigned int *dst, const unsigned char *src, int count, const unsigned int *palette)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i bytes = _mm_loadl_epi64((const __m128i *)(src + i));
+        __m256i indices = _mm256_cvtepu8_epi32(bytes);
+        __m256i colors = _mm256_i32gather_epi32((const int *)palette, indices, 4);
+        _mm256_storeu_si256((__m256i *)(dst + i), colors);
+    }
+
+    scalarLookup(dst + i, src + i, count - i, palette);
+}
+
+RASTER_TARGET("avx2")
+static void avx2Accumulate(int *acc, const unsigned char *src, int count, int weight)
+{
+    __m256i w = _mm256_set1_epi32(weight);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i x = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+        __m256i *a = (__m256i *)(acc + i);
+        _mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), _mm256_mullo_epi32(x, w)));
+    }
+
+    scalarAccumulate(acc + i, src + i, count - i, weight);
+}
+
+static int cpuSupports(const char *feature)
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    if (strcmp(feature, "sse2") == 0)
+        return (info[3] & (1 << 26)) != 0;
+
+    // AVX2 also needs the OS to save the upper halves of the ymm registers.
+    int osxsave = (info[2] & (1 << 27)) != 0;
+    int avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || maxLeaf < 7)
+        return 0;
+    if ((_xgetbv(0) & 6) != 6)
+        return 0;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    if (strcmp(feature, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+#ifdef RASTER_NEON
+
+static void neonFill(unsigned int *dst, int count, unsigned int color)
+{
+    uint32x4_t c = vdupq_n_u32(color);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        vst1q_u32(dst + i, c);
+        vst1q_u32(dst + i + 4, c);
+        vst1q_u32(dst + i + 8, c);
+        vst1q_u32(dst + i + 12, c);
+    }
+    for (; i + 4 <= count; i += 4)
+        vst1q_u32(dst + i, c);
+
+    for (; i < count; i++)
+        dst[i] = color;
+}
+
+static void neonCopyKeyed(unsigned int *dst, const unsigned int *src, int count, unsigned int key)
+{
+    uint32x4_t k = vdupq_n_u32(key);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32x4_t s = vld1q_u32(src + i);
+        uint32x4_t d = vld1q_u32(dst + i);
+        uint32x4_t m = vceqq_u32(s, k);
+        vst1q_u32(dst + i, vbslq_u32(m, d, s));
+    }
+
+    scalarCopyKeyed(dst + i, src + i, count - i, key);
+}
+
+static void neonTint(unsigned int *dst, const unsigned int *src, int count, unsigned int color)
+{
+    uint64_t r = ((color >> 16) & 0xFF) + 1;
+    uint64_t g = ((color >> 8) & 0xFF) + 1;
+    uint64_t b = (color & 0xFF) + 1;
+    uint16x4_t half = vcreate_u16(b | g << 16 | r << 32 | (uint64_t)256 << 48);
+    uint16x8_t factors = vcombine_u16(half, half);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        uint8x16_t s = vld1q_u8((const uint8_t *)(src + i));
+        uint16x8_t lo = vmulq_u16(vmovl_u8(vget_low_u8(s)), factors);
+        uint16x8_t hi = vmulq_u16(vmovl_u8(vget_high_u8(s)), factors);
+        vst1q_u8((uint8_t *)(dst + i), vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+    }
+
+    scalarTint(dst + i, src + i, count - i, color);
+}
+
+static void neonSwapRB(void *dst, const void *src, int count)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16x4_t x = vld4q_u8(s + i * 4);
+        uint8x16_t first = x.val[0];
+        x.val[0] = x.val[2];
+        x.val[2] = first;
+        vst4q_u8(d + i * 4, x);
+    }
+
+    scalarSwapRB(d + i * 4, s + i * 4, count - i);
+}
+
+static void neonGrayToArgb(unsigned int *dst, const unsigned char *src, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16x4_t x;
+        x.val[0] = vld1q_u8(src + i);
+        x.val[1] = x.val[0];
+        x.val[2] = x.val[0];
+        x.val[3] = vdupq_n_u8(0xFF);
+        vst4q_u8((unsigned char *)(dst + i), x);
+    }
+
+    scalarGrayToArgb(dst + i, src + i, count - i);
+}
+
+static void neonCopyKeyed8(unsigned char *dst, const unsigned char *src, int count, unsigned char key)
+{
+    uint8x16_t k = vdupq_n_u8(key);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16_t s = vld1q_u8(src + i);
+        uint8x16_t d = vld1q_u8(dst + i);
+        uint8x16_t m = vceqq_u8(s, k);
+        vst1q_u8(dst + i, vbslq_u8(m, d, s));
+    }
+
+    scalarCopyKeyed8(dst + i, src + i, count - i, key);
+}
+
+static void neonAccumulate(int *acc, const unsigned char *src, int count, int weight)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        int16x8_t x = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(src + i)));
+        vst1q_s32(acc + i, vmlal_n_s16(vld1q_s32(acc + i), vget_low_s16(x), (short)weight));
+        vst1q_s32(acc + i + 4, vmlal_n_s16(vld1q_s32(acc + i + 4), vget_high_s16(x), (short)weight));
+    }
+
+    scalarAccumulate(acc + i, src + i, count - i, weight);
+}
+
+static uint16x4_t neonPackLanes(const int *acc, float scale)
+{
+    float32x4_t v = vmlaq_n_f32(vdupq_n_f32(0.5f), vcvtq_f32_s32(vld1q_s32(acc)), scale);
+    v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(0.0f)), vdupq_n_f32(255.0f));
+    return vmovn_u32(vcvtq_u32_f32(v));
+}
+
+static void neonPack(unsigned char *dst, const int *acc, int count, float scale)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x8_t x = vcombine_u16(neonPackLanes(acc + i, scale), neonPackLanes(acc + i + 4, scale));
+        vst1_u8(dst + i, vmovn_u16(x));
+    }
+
+    scalarPack(dst + i, acc + i, count - i, scale);
+}
+
+static void neonColorMatrix(unsigned int *dst, const unsigned int *src, int count, const float *matrix)
+{
+    float32x4_t c0 = vld1q_f32(matrix);
+    float32x4_t c1 = vld1q_f32(matrix + 4);
+    float32x4_t c2 = vld1q_f32(matrix + 8);
+    float32x4_t c3 = vld1q_f32(matrix + 12);
+    float32x4_t offset = vaddq_f32(vld1q_f32(matrix + 16), vdupq_n_f32(0.5f));
+
+    for (int i = 0; i < count; i++)
+    {
+        uint8x8_t p = vreinterpret_u8_u32(vdup_n_u32(src[i]));
+        float32x4_t f = vcvtq_f32_u32(vmovl_u16(vget_low_u16(vmovl_u8(p))));
+
+        float32x4_t v = offset;
+        v = vmlaq_n_f32(v, c0, vgetq_lane_f32(f, 0));
+        v = vmlaq_n_f32(v, c1, vgetq_lane_f32(f, 1));
+        v = vmlaq_n_f32(v, c2, vgetq_lane_f32(f, 2));
+        v = vmlaq_n_f32(v, c3, vgetq_lane_f32(f, 3));
+        v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(0.0f)), vdupq_n_f32(255.0f));
+
+        uint16x4_t n = vmovn_u32(vcvtq_u32_f32(v));
+        uint8x8_t b = vmovn_u16(vcombine_u16(n, n));
+        dst[i] = vget_lane_u32(vreinterpret_u32_u8(b), 0);
+    }
+}
+
+#endif
+
+void rasterInit(void)
+{
+    raster.name = "scalar";
+    raster.fill = scalarFill;
+    raster.copy = scalarCopy;
+    raster.copyKeyed = scalarCopyKeyed;
+    raster.blend = scalarBlend;
+    raster.tint = scalarTint;
+    raster.coverage = scalarCoverage;
+    raster.swapRB = scalarSwapRB;
+    raster.grayToArgb = scalarGrayToArgb;
+    raster.lookup = scalarLookup;
+    raster.copyKeyed8 = scalarCopyKeyed8;
+    raster.accumulate = scalarAccumulate;
+    raster.pack = scalarPack;
+    raster.colorMatrix = scalarColorMatrix;
+
+#ifdef RASTER_X86
+    if (cpuSupports("sse2"))
+    {
+        raster.name = "sse2";
+        raster.fill = sse2Fill;
+        raster.copy = sse2Copy;
+        raster.copyKeyed = sse2CopyKeyed;
+        raster.blend = sse2Blend;
+        raster.tint = sse2Tint;
+        raster.coverage = sse2Coverage;
+        raster.swapRB = sse2SwapRB;
+        raster.grayToArgb = sse2GrayToArgb;
+        raster.copyKeyed8 = sse2CopyKeyed8;
+        raster.accumulate = sse2Accumulate;
+        raster.pack = sse2Pack;
+        raster.colorMatrix = sse2ColorMatrix;
+    }
+
+    if (cpuSupports("avx2"))
+    {
+        raster.name = "avx2";
+        raster.fill = avx2Fill;
+        raster.copy = avx2Copy;
+        raster.copyKeyed = avx2CopyKeyed;
+        raster.tint = avx2Tint;
+        raster.swapRB = avx2SwapRB;
+        raster.lookup = avx2Lookup;
+        raster.accumulate = avx2Accumulate;
+    }
+#endif
+
+#ifdef RASTER_NEON
+    raster.name = "neon";
+    raster.fill = neonFill;
+    raster.copyKeyed = neonCopyKeyed;
+    raster.tint = neonTint;
+    raster.swapRB = neonSwapRB;
+    raster.grayToArgb = neonGrayToArgb;
+    raster.copyKeyed8 = neonCopyKeyed8;
+    raster.accumulate = neonAccumulate;
+    raster.pack = neonPack;
+    raster.colorMatrix = neonColorMatrix;
+#endif
+}
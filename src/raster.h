@@ -0,0 +1,59 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+typedef enum
+{
+    BLEND_ALPHA,
+    BLEND_ADD,
+    BLEND_MULTIPLY,
+    BLEND_OPACITY
+} BlendMode;
+
+// Span kernels used by the drawing functions in api.c. Every kernel works on a
+// single run of 32-bit ARGB pixels, so callers handle clipping and row strides.
+// The table is filled by rasterInit() with the fastest implementation the CPU
+// supports.
+typedef struct Raster
+{
+    const char *name;
+    void (*fill)(unsigned int *dst, int count, unsigned int color);
+    void (*copy)(unsigned int *dst, const unsigned int *src, int count);
+    void (*copyKeyed)(unsigned int *dst, const unsigned int *src, int count, unsigned int key);
+    void (*blend)(unsigned int *dst, const unsigned int *src, int count, BlendMode mode, unsigned int opacity);
+
+    // Copies src scaling its color channels by those of color and keeping its
+    // alpha. A channel c becomes c * (t + 1) >> 8, so white copies unchanged.
+    void (*tint)(unsigned int *dst, const unsigned int *src, int count, unsigned int color);
+
+    // Draws color over dst through one coverage byte per pixel, as if color
+    // had its alpha scaled by the coverage. Used for anti-aliased glyphs.
+    void (*coverage)(unsigned int *dst, const unsigned char *src, int count, unsigned int color);
+
+    // Conversions between bitmap pixels and byte data from outside. swapRB
+    // swaps the first and third byte of every 4-byte pixel, which turns RGBA
+    // bytes into ARGB words and back; neither pointer has to be aligned and
+    // dst may equal src. grayToArgb expands one byte per pixel to opaque gray.
+    void (*swapRB)(void *dst, const void *src, int count);
+    void (*grayToArgb)(unsigned int *dst, const unsigned char *src, int count);
+
+    // Kernels for 8-bit indexed pixels. lookup expands indices through a
+    // 256-entry palette; copyKeyed8 skips source bytes equal to key.
+    void (*lookup)(unsigned int *dst, const unsigned char *src, int count, const unsigned int *palette);
+    void (*copyKeyed8)(unsigned char *dst, const unsigned char *src, int count, unsigned char key);
+
+    // Kernels for the filters in filter.c, which treat pixels as runs of
+    // bytes so every channel is handled alike. accumulate adds src * weight
+    // to acc, with weight in the range of a signed 16-bit integer. pack stores
+    // acc * scale rounded and clamped to 0..255. colorMatrix maps every pixel
+    // through 20 floats: four columns of per-byte weights, one for each input
+    // byte, followed by a column of offsets. dst may equal src.
+    void (*accumulate)(int *acc, const unsigned char *src, int count, int weight);
+    void (*pack)(unsigned char *dst, const int *acc, int count, float scale);
+    void (*colorMatrix)(unsigned int *dst, const unsigned int *src, int count, const float *matrix);
+} Raster;
+
+extern Raster raster;
+
+void rasterInit(void);
+
+#endif
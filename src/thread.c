@@ -0,0 +1,387 @@
+#include "thread.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define MAX_WORKERS 32
+
+struct Mutex
+{
+#ifdef _WIN32
+    CRITICAL_SECTION cs;
+#else
+    pthread_mutex_t mutex;
+#endif
+};
+
+struct Cond
+{
+#ifdef _WIN32
+    CONDITION_VARIABLE cv;
+#else
+    pthread_cond_t cond;
+#endif
+};
+
+struct Thread
+{
+    ThreadFn fn;
+    void *data;
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t thread;
+#endif
+};
+
+Mutex *mutexCreate(void)
+{
+    Mutex *mutex = (Mutex *)malloc(sizeof(Mutex));
+    if (mutex == NULL)
+        return NULL;
+
+#ifdef _WIN32
+    InitializeCriticalSection(&mutex->cs);
+#else
+    pthread_mutex_init(&mutex->mutex, NULL);
+#endif
+
+    return mutex;
+}
+
+void mutexDestroy(Mutex *mutex)
+{
+    if (mutex == NULL)
+        return;
+
+#ifdef _WIN32
+    DeleteCriticalSection(&mutex->cs);
+#else
+    pthread_mutex_destroy(&mutex->mutex);
+#endif
+
+    free(mutex);
+}
+
+void mutexLock(Mutex *mutex)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&mutex->cs);
+#else
+    pthread_mutex_lock(&mutex->mutex);
+#endif
+}
+
+void mutexUnlock(Mutex *mutex)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&mutex->cs);
+#else
+    pthread_mutex_unlock(&mutex->mutex);
+#endif
+}
+
+Cond *condCreate(void)
+{
+    Cond *cond = (Cond *)malloc(sizeof(Cond));
+    if (cond == NULL)
+        return NULL;
+
+#ifdef _WIN32
+    InitializeConditionVariable(&cond->cv);
+#else
+    pthread_cond_init(&cond->cond, NULL);
+#endif
+
+    return cond;
+}
+
+void condDestroy(Cond *cond)
+{
+    if (cond == NULL)
+        return;
+
+#ifndef _WIN32
+    pthread_cond_destroy(&cond->cond);
+#endif
+
+    free(cond);
+}
+
+void condWait(Cond *cond, Mutex *mutex)
+{
+#ifdef _WIN32
+    SleepConditionVariableCS(&cond->cv, &mutex->cs, INFINITE);
+#else
+    pthread_cond_wait(&cond->cond, &mutex->mutex);
+#endif
+}
+
+void condSignal(Cond *cond)
+{
+#ifdef _WIN32
+    WakeConditionVariable(&cond->cv);
+#else
+    pthread_cond_signal(&cond->cond);
+#endif
+}
+
+void condBroadcast(Cond *cond)
+{
+#ifdef _WIN32
+    WakeAllConditionVariable(&cond->cv);
+#else
+    pthread_cond_broadcast(&cond->cond);
+#endif
+}
+
+#ifdef _WIN32
+static DWORD WINAPI threadMain(LPVOID param)
+{
+    Thread *thread = (Thread *)param;
+    thread->fn(thread->data);
+    return 0;
+}
+#else
+static void *threadMain(void *param)
+{
+    Thread *thread = (Thread *)param;
+    thread->fn(thread->data);
+    return NULL;
+}
+#endif
+
+Thread *threadCreate(ThreadFn fn, void *data)
+{
+    Thread *thread = (Thread *)malloc(sizeof(Thread));
+    if (thread == NULL)
+        return NULL;
+
+    thread->fn = fn;
+    thread->data = data;
+
+#ifdef _WIN32
+    thread->handle = CreateThread(NULL, 0, threadMain, thread, 0, NULL);
+    if (thread->handle == NULL)
+    {
+        free(thread);
+        return NULL;
+    }
+#else
+    if (pthread_create(&thread->thread, NULL, threadMain, thread) != 0)
+    {
+        free(thread);
+        return NULL;
+    }
+#endif
+
+    return thread;
+}
+
+void threadJoin(Thread *thread)
+{
+    if (thread == NULL)
+        return;
+
+#ifdef _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    pthread_join(thread->thread, NULL);
+#endif
+
+    free(thread);
+}
+
+int cpuCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int count = (int)info.dwNumberOfProcessors;
+#else
+    int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    return count > 0 ? count : 1;
+}
+
+typedef struct Job
+{
+    JobFn fn;
+    void *data;
+    struct Job *next;
+} Job;
+
+typedef struct Range
+{
+    RangeFn fn;
+    void *data;
+    int count;
+    int next;
+    int done;
+    int active;
+} Range;
+
+static Mutex *jobsMutex = NULL;
+static Cond *jobsWake = NULL;
+static Cond *jobsDone = NULL;
+static Job *jobsHead = NULL;
+static Job *jobsTail = NULL;
+static Range *jobsRange = NULL;
+static int jobsWorkers = -1;
+
+// Runs indices of the current range until none are left. Called with the
+// mutex held and returns with it held.
+static void runRange(Range *range)
+{
+    range->active++;
+
+    while (range->next < range->count)
+    {
+        int index = range->next++;
+
+        mutexUnlock(jobsMutex);
+        range->fn(range->data, index);
+        mutexLock(jobsMutex);
+
+        range->done++;
+    }
+
+    range->active--;
+    if (range->done == range->count && range->active == 0)
+        condBroadcast(jobsDone);
+}
+
+static void workerMain(void *data)
+{
+    mutexLock(jobsMutex);
+
+    for (;;)
+    {
+        if (jobsRange != NULL && jobsRange->next < jobsRange->count)
+        {
+            runRange(jobsRange);
+            continue;
+        }
+
+        if (jobsHead != NULL)
+        {
+            Job *job = jobsHead;
+            jobsHead = job->next;
+            if (jobsHead == NULL)
+                jobsTail = NULL;
+
+            mutexUnlock(jobsMutex);
+            job->fn(job->data);
+            free(job);
+            mutexLock(jobsMutex);
+            continue;
+        }
+
+        condWait(jobsWake, jobsMutex);
+    }
+}
+
+static void startWorkers(void)
+{
+    if (jobsWorkers >= 0)
+        return;
+
+    jobsWorkers = 0;
+    jobsMutex = mutexCreate();
+    jobsWake = condCreate();
+    jobsDone = condCreate();
+    if (jobsMutex == NULL || jobsWake == NULL || jobsDone == NULL)
+        return;
+
+    int count = cpuCount() - 1;
+    if (count < 1)
+        count = 1;
+    if (count > MAX_WORKERS)
+        count = MAX_WORKERS;
+
+    // Workers live for the whole process, so their Thread records are never
+    // joined or freed.
+    for (int i = 0; i < count; i++)
+    {
+        if (threadCreate(workerMain, NULL) == NULL)
+            break;
+
+        jobsWorkers++;
+    }
+}
+
+int jobsWorkerCount(void)
+{
+    startWorkers();
+
+    return jobsWorkers;
+}
+
+bool jobsSubmit(JobFn fn, void *data)
+{
+    startWorkers();
+
+    if (jobsWorkers == 0)
+        return false;
+
+    Job *job = (Job *)malloc(sizeof(Job));
+    if (job == NULL)
+        return false;
+
+    job->fn = fn;
+    job->data = data;
+    job->next = NULL;
+
+    mutexLock(jobsMutex);
+
+    if (jobsTail != NULL)
+        jobsTail->next = job;
+    else
+        jobsHead = job;
+    jobsTail = job;
+
+    condSignal(jobsWake);
+    mutexUnlock(jobsMutex);
+
+    return true;
+}
+
+void jobsParallel(int count, RangeFn fn, void *data)
+{
+    startWorkers();
+
+    if (jobsWorkers == 0 || count <= 1)
+    {
+        for (int i = 0; i < count; i++)
+            fn(data, i);
+        return;
+    }
+
+    Range range = {fn, data, count, 0, 0, 0};
+
+    mutexLock(jobsMutex);
+
+    // Only one range runs at a time; a second caller waits for its turn.
+    while (jobsRange != NULL)
+        condWait(jobsDone, jobsMutex);
+
+    jobsRange = &range;
+    condBroadcast(jobsWake);
+
+    runRange(&range);
+    while (range.done < range.count || range.active > 0)
+        condWait(jobsDone, jobsMutex);
+
+    jobsRange = NULL;
+    condBroadcast(jobsDone);
+    mutexUnlock(jobsMutex);
+}
@@ -0,0 +1,39 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stdbool.h>
+
+typedef struct Mutex Mutex;
+typedef struct Cond Cond;
+typedef struct Thread Thread;
+
+typedef void (*ThreadFn)(void *data);
+typedef void (*JobFn)(void *data);
+typedef void (*RangeFn)(void *data, int index);
+
+Mutex *mutexCreate(void);
+void mutexDestroy(Mutex *mutex);
+void mutexLock(Mutex *mutex);
+void mutexUnlock(Mutex *mutex);
+
+Cond *condCreate(void);
+void condDestroy(Cond *cond);
+void condWait(Cond *cond, Mutex *mutex);
+void condSignal(Cond *cond);
+void condBroadcast(Cond *cond);
+
+Thread *threadCreate(ThreadFn fn, void *data);
+void threadJoin(Thread *thread);
+
+int cpuCount(void);
+
+// Shared worker pool, started on first use with one worker per extra core.
+// jobsSubmit queues fn to run on a worker and returns immediately.
+// jobsParallel calls fn for every index in [0, count) and returns once all of
+// them are done; the calling thread takes indices as well, so it always makes
+// progress even when every worker is busy with submitted jobs.
+int jobsWorkerCount(void);
+bool jobsSubmit(JobFn fn, void *data);
+void jobsParallel(int count, RangeFn fn, void *data);
+
+#endif